@@ -0,0 +1,109 @@
+#include <string>
+#include <cstring>
+
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <tokyooo/bdb.hpp>
+#include <tokyooo/hdb.hpp>
+#include "harness.hpp"
+
+using namespace tokyooo;
+
+namespace bench {
+
+namespace {
+
+typedef basic_bdb<int64_order> ordered_bdb;
+
+// scans of [lo, lo + width) over dense int64 keys.  hdb has no order, so it either looks up every
+// key in the range - only possible because we know they're dense - or walks the whole database
+void ranges(harness & b)
+{
+  std::size_t n = b.ops(200000);
+  std::string value(64, 'x');
+  ordered_bdb t(b.path("range.tcb"), bdb::open_options_e(bdb::writer | bdb::create | bdb::trunc));
+  hdb h(b.path("range.tch"), hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), false, n * 2);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    t.put(boost::int64_t(i), value);
+    h.put(boost::int64_t(i), value);
+  }
+  static const std::size_t widths[] = { 10, 100, 1000, 10000 };
+  for (std::size_t wi = 0; wi < 4; ++wi)
+  {
+    std::size_t width = std::min(widths[wi], n);
+    std::size_t scans = std::max<std::size_t>(b.ops(200000) / width, 10);
+    params p;
+    p.set("records", n).set("width", width).set("value_size", 64);
+    run(b, "bdb", "range", p, scans, [&](std::size_t i) {
+      boost::int64_t lo = (i * 7919) % (n - width + 1);
+      ordered_bdb::record_range r = t.range(lo, boost::int64_t(lo + width));
+      for (ordered_bdb::iterator it = r.begin(); it != r.end(); ++it)
+        sink += it->value.size;
+    }, width);
+    view v;
+    run(b, "bdb", "hdb_gets", p, scans, [&](std::size_t i) {
+      boost::int64_t lo = (i * 7919) % (n - width + 1);
+      for (boost::int64_t k = lo; k < boost::int64_t(lo + width); ++k)
+      {
+        h.get_view(k, v);
+        sink += v.size;
+      }
+    }, width);
+    // the whole database every time, so only a few of these
+    run(b, "bdb", "hdb_scan", p, std::max<std::size_t>(b.ops(20), 2), [&](std::size_t i) {
+      boost::int64_t lo = (i * 7919) % (n - width + 1), hi = lo + width;
+      for (hdb::iterator it = h.begin(); it != h.end(); ++it)
+      {
+        boost::int64_t k;
+        std::memcpy(&k, it->key.data, sizeof(k));
+        if (k >= lo && k < hi)
+          sink += it->value.size;
+      }
+    }, width);
+  }
+}
+
+// everything under one of 1000 string prefixes, against a filtered walk of a whole hdb
+void prefixes(harness & b)
+{
+  std::size_t n = b.ops(200000);
+  const std::size_t users = 1000;
+  std::string value(64, 'x');
+  bdb t(b.path("prefix.tcb"), bdb::open_options_e(bdb::writer | bdb::create | bdb::trunc));
+  hdb h(b.path("prefix.tch"), hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), false, n * 2);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    std::string key = "user:" + boost::lexical_cast<std::string>(i % users) + ":" + boost::lexical_cast<std::string>(i);
+    t.put(key, value);
+    h.put(key, value);
+  }
+  params p;
+  p.set("records", n).set("prefixes", users).set("value_size", 64);
+  run(b, "bdb_prefix", "prefix", p, b.ops(10000), [&](std::size_t i) {
+    bdb::record_range r = t.prefix("user:" + boost::lexical_cast<std::string>(i % users) + ":");
+    for (bdb::iterator it = r.begin(); it != r.end(); ++it)
+      sink += it->value.size;
+  }, n / users);
+  run(b, "bdb_prefix", "hdb_scan", p, std::max<std::size_t>(b.ops(20), 2), [&](std::size_t i) {
+    std::string prefix = "user:" + boost::lexical_cast<std::string>(i % users) + ":";
+    for (hdb::iterator it = h.begin(); it != h.end(); ++it)
+    {
+      if (it->key.size >= int(prefix.size()) && std::memcmp(it->key.data, prefix.data(), prefix.size()) == 0)
+        sink += it->value.size;
+    }
+  }, n / users);
+}
+
+} // anonymous
+
+void bdb_benchmarks(harness & b)
+{
+  if (b.wants("bdb"))
+    ranges(b);
+  if (b.wants("bdb_prefix"))
+    prefixes(b);
+}
+
+} // bench
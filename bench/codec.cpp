@@ -0,0 +1,140 @@
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include <tokyooo/codec.hpp>
+#include <tokyooo/util.hpp>
+#include <tokyooo/map.hpp>
+#include <tokyooo/list.hpp>
+#include "harness.hpp"
+
+namespace bench {
+
+struct sample_row
+{
+  boost::int64_t id;
+  std::string name;
+  std::vector<int> scores;
+};
+
+} // bench
+
+TOKYOOO_CODEC(bench::sample_row, (id)(name)(scores))
+
+using namespace tokyooo;
+
+namespace bench {
+
+namespace {
+
+template<class T>
+void encode_decode(harness & b, const std::string & name, const T & value)
+{
+  std::size_t n = b.ops(1000000);
+  params p;
+  p.set("type", name);
+  {
+    packed e(value);
+    p.set("encoded_size", e.size());
+  }
+  run(b, "codec", "encode", p, n, [&](std::size_t) {
+    packed e(value);
+    sink += e.size();
+  });
+  packed e(value);
+  T out;
+  run(b, "codec", "decode", p, n, [&](std::size_t) { unpack(out, e.data(), e.size()); });
+}
+
+void codecs(harness & b)
+{
+  encode_decode(b, "int", 12345);
+  encode_decode(b, "double", 3.25);
+  encode_decode(b, "string_16", std::string(16, 'x'));
+  encode_decode(b, "string_4096", std::string(4096, 'x'));
+  encode_decode(b, "vector_int_256", std::vector<int>(256, 7));
+  std::vector<std::string> strings(64, std::string(32, 'x'));
+  encode_decode(b, "vector_string_64", strings);
+  sample_row row;
+  row.id = 42;
+  row.name = "somebody";
+  row.scores.assign(16, 3);
+  encode_decode(b, "struct", row);
+}
+
+void maps(harness & b)
+{
+  static const std::size_t sizes[] = { 16, 1024, 65536 };
+  for (std::size_t s = 0; s < 3; ++s)
+  {
+    std::size_t rounds = b.ops(std::max<std::size_t>(1000000 / sizes[s], 10));
+    params p;
+    p.set("entries", sizes[s]);
+    std::vector< std::pair<int, std::string> > items;
+    for (std::size_t i = 0; i < sizes[s]; ++i)
+      items.push_back(std::make_pair(int(i), std::string(32, 'x')));
+    run(b, "map", "build", p, rounds, [&](std::size_t) {
+      map m(items.begin(), items.end());
+      sink += m.size();
+    }, sizes[s]);
+    map m(items.begin(), items.end());
+    run(b, "map", "iterate", p, rounds, [&](std::size_t) {
+      for (map::const_iterator it = m.begin(); it != m.end(); ++it)
+        sink += it->value.size;
+    }, sizes[s]);
+    std::string value;
+    run(b, "map", "get", p, rounds, [&](std::size_t) {
+      for (std::size_t i = 0; i < sizes[s]; ++i)
+        m.get(int(i), value);
+    }, sizes[s]);
+    run(b, "map", "copy_to", p, rounds, [&](std::size_t) {
+      std::vector< std::pair<int, std::string> > out;
+      m.copy_to(out);
+      sink += out.size();
+    }, sizes[s]);
+  }
+}
+
+void lists(harness & b)
+{
+  static const std::size_t sizes[] = { 16, 1024, 65536 };
+  for (std::size_t s = 0; s < 3; ++s)
+  {
+    std::size_t rounds = b.ops(std::max<std::size_t>(1000000 / sizes[s], 10));
+    params p;
+    p.set("items", sizes[s]);
+    std::vector<int> items;
+    for (std::size_t i = 0; i < sizes[s]; ++i)
+      items.push_back(int(i));
+    run(b, "list", "build", p, rounds, [&](std::size_t) {
+      list l(items.begin(), items.end());
+      sink += l.size();
+    }, sizes[s]);
+    list l(items.begin(), items.end());
+    run(b, "list", "iterate", p, rounds, [&](std::size_t) {
+      for (list::const_iterator it = l.begin(); it != l.end(); ++it)
+        sink += it->size;
+    }, sizes[s]);
+    int x = 0;
+    run(b, "list", "get", p, rounds, [&](std::size_t) {
+      for (int i = 0; l.get(x, i); ++i)
+        sink += x;
+    }, sizes[s]);
+    run(b, "list", "to_vector", p, rounds, [&](std::size_t) { sink += l.to_vector<int>().size(); }, sizes[s]);
+  }
+}
+
+} // anonymous
+
+void codec_benchmarks(harness & b)
+{
+  if (b.wants("codec"))
+    codecs(b);
+  if (b.wants("map"))
+    maps(b);
+  if (b.wants("list"))
+    lists(b);
+}
+
+} // bench
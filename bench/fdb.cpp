@@ -0,0 +1,79 @@
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include <tokyooo/fdb.hpp>
+#include <tokyooo/hdb.hpp>
+#include "harness.hpp"
+
+using namespace tokyooo;
+
+namespace bench {
+
+namespace {
+
+struct sample
+{
+  boost::int64_t id;
+  double score;
+  boost::int32_t flags;
+  boost::int32_t count;
+};
+
+// the same records under dense ids in an fdb and an hdb.  the file sizes go in the params of the
+// get runs, which is where you'd look for them
+void dense(harness & b)
+{
+  std::size_t n = b.ops(1000000);
+  sample s = { 0, 1.5, 0, 0 };
+  fdb<sample> f(b.path("dense.tcf"), fdb_base::open_options_e(fdb_base::writer | fdb_base::create | fdb_base::trunc),
+                false, boost::int64_t(n + 1) * sizeof(sample) * 2);
+  hdb h(b.path("dense.tch"), hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), false, n * 2);
+  params p;
+  p.set("records", n).set("value_size", sizeof(sample));
+  run(b, "fdb", "fdb_put", p, n, [&](std::size_t i) {
+    s.id = i + 1;
+    f.put(s.id, s);
+  });
+  run(b, "fdb", "hdb_put", p, n, [&](std::size_t i) {
+    s.id = i + 1;
+    h.put(s.id, s);
+  });
+  f.sync();
+  h.sync();
+  params fp = p, hp = p;
+  fp.set("file_bytes", f.fsize());
+  hp.set("file_bytes", h.fsize());
+  run(b, "fdb", "fdb_get", fp, n, [&](std::size_t i) {
+    f.get(boost::int64_t((i * 7919) % n + 1), s);
+    sink += s.flags;
+  });
+  run(b, "fdb", "hdb_get", hp, n, [&](std::size_t i) {
+    h.get(boost::int64_t((i * 7919) % n + 1), s);
+    sink += s.flags;
+  });
+  static const std::size_t widths[] = { 100, 10000 };
+  for (std::size_t wi = 0; wi < 2; ++wi)
+  {
+    std::size_t width = std::min(widths[wi], n);
+    params rp = p;
+    rp.set("width", width);
+    std::vector< std::pair<boost::int64_t, sample> > out;
+    run(b, "fdb", "fdb_range", rp, std::max<std::size_t>(b.ops(200000) / width, 10), [&](std::size_t i) {
+      boost::int64_t lo = (i * 7919) % (n - width + 1) + 1;
+      out.clear();
+      f.range(lo, lo + width, out);
+      sink += out.size();
+    }, width);
+  }
+}
+
+} // anonymous
+
+void fdb_benchmarks(harness & b)
+{
+  if (b.wants("fdb"))
+    dense(b);
+}
+
+} // bench
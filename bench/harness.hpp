@@ -0,0 +1,326 @@
+#ifndef __TOKYOOO_BENCH_HARNESS_HPP__
+#define __TOKYOOO_BENCH_HARNESS_HPP__
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <ostream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <csignal>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <tcrdb.h>
+
+namespace bench {
+
+inline boost::uint64_t now_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return boost::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// keeps the optimizer from throwing away work whose result isn't used.  defined in main.cpp
+extern volatile std::size_t sink;
+
+// every sample kept, so percentiles are exact.  runs are sized to keep that cheap
+class histogram
+{
+private:
+
+  std::vector<boost::uint64_t> samples_;
+
+  bool sorted_;
+
+public:
+
+  histogram() : sorted_(true) {}
+
+  void reserve(std::size_t n) { samples_.reserve(n); }
+
+  void add(boost::uint64_t ns)
+  {
+    samples_.push_back(ns);
+    sorted_ = false;
+  }
+
+  void merge(const histogram & other)
+  {
+    samples_.insert(samples_.end(), other.samples_.begin(), other.samples_.end());
+    sorted_ = false;
+  }
+
+  std::size_t size() const { return samples_.size(); }
+
+  // q in [0, 1]
+  boost::uint64_t percentile(double q)
+  {
+    if (samples_.empty())
+      return 0;
+    if (!sorted_)
+    {
+      std::sort(samples_.begin(), samples_.end());
+      sorted_ = true;
+    }
+    std::size_t i = static_cast<std::size_t>(q * (samples_.size() - 1) + 0.5);
+    return samples_[std::min(i, samples_.size() - 1)];
+  }
+};
+
+// name/value pairs describing one measurement, e.g. value_size=64
+class params
+{
+private:
+
+  std::vector< std::pair<std::string, std::string> > items_;
+
+public:
+
+  template<class T>
+  params & set(const std::string & name, const T & value)
+  {
+    items_.push_back(std::make_pair(name, boost::lexical_cast<std::string>(value)));
+    return *this;
+  }
+
+  const std::vector< std::pair<std::string, std::string> > & items() const { return items_; }
+};
+
+inline std::string json_string(const std::string & s)
+{
+  std::string ret_val = "\"";
+  for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+  {
+    if (*it == '"' || *it == '\\')
+      ret_val += '\\';
+    ret_val += *it;
+  }
+  return ret_val + "\"";
+}
+
+// writes a json array of results, one object per measurement:
+//
+//   {"suite": "hdb", "name": "put", "params": {"value_size": "64"}, "ops": 100000,
+//    "seconds": 0.21, "ops_per_sec": 476190, "p50_ns": 1800, "p99_ns": 4100, "p999_ns": 9800}
+class harness : public boost::noncopyable
+{
+private:
+
+  std::ostream & out_;
+
+  std::string filter_;
+
+  bool quick_;
+
+  bool first_;
+
+  std::string dir_;
+
+public:
+
+  // only suites whose name contains filter run.  quick cuts every run to a tenth
+  harness(std::ostream & out, const std::string & filter, bool quick)
+  : out_(out), filter_(filter), quick_(quick), first_(true)
+  {
+    char dir[] = "/tmp/tokyooo_bench.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+      std::perror("mkdtemp");
+      std::exit(1);
+    }
+    dir_ = dir;
+    out_ << "[" << std::endl;
+  }
+
+  ~harness()
+  {
+    out_ << std::endl << "]" << std::endl;
+    std::string cmd = "rm -rf " + dir_;
+    if (std::system(cmd.c_str()) != 0)
+      std::cerr << "bench: couldn't remove " << dir_ << std::endl;
+  }
+
+  bool wants(const std::string & suite) const
+  {
+    return filter_.empty() || suite.find(filter_) != std::string::npos;
+  }
+
+  std::size_t ops(std::size_t full) const
+  {
+    return std::max<std::size_t>(quick_ ? full / 10 : full, 1);
+  }
+
+  // a fresh path in the scratch directory, which goes away at the end
+  std::string path(const std::string & name) const
+  {
+    return dir_ + "/" + name;
+  }
+
+  void report(const std::string & suite, const std::string & name, const params & p, histogram & h,
+              double seconds, boost::uint64_t ops)
+  {
+    if (!first_)
+      out_ << "," << std::endl;
+    first_ = false;
+    out_ << "  {\"suite\": " << json_string(suite) << ", \"name\": " << json_string(name) << ", \"params\": {";
+    for (std::size_t i = 0; i < p.items().size(); ++i)
+      out_ << (i ? ", " : "") << json_string(p.items()[i].first) << ": " << json_string(p.items()[i].second);
+    out_ << "}, \"ops\": " << ops << ", \"seconds\": " << seconds
+         << ", \"ops_per_sec\": " << (seconds > 0 ? ops / seconds : 0)
+         << ", \"p50_ns\": " << h.percentile(0.5) << ", \"p99_ns\": " << h.percentile(0.99)
+         << ", \"p999_ns\": " << h.percentile(0.999) << "}" << std::flush;
+    std::cerr << suite << "/" << name << ": " << static_cast<boost::uint64_t>(seconds > 0 ? ops / seconds : 0)
+              << " ops/s" << std::endl;
+  }
+};
+
+// times f(i) for every i in [0, n).  ops_per_call is for calls that do several things at once
+template<class F>
+void run(harness & b, const std::string & suite, const std::string & name, const params & p, std::size_t n, F f,
+         std::size_t ops_per_call = 1)
+{
+  histogram h;
+  h.reserve(n);
+  boost::uint64_t start = now_ns();
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    boost::uint64_t t = now_ns();
+    f(i);
+    h.add(now_ns() - t);
+  }
+  double seconds = (now_ns() - start) / 1e9;
+  b.report(suite, name, p, h, seconds, n * ops_per_call);
+}
+
+namespace detail {
+
+template<class F>
+struct thread_job
+{
+  F & f;
+  std::size_t thread;
+  std::size_t n;
+  histogram & h;
+
+  void operator() ()
+  {
+    h.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      boost::uint64_t t = now_ns();
+      f(thread, i);
+      h.add(now_ns() - t);
+    }
+  }
+};
+
+} // detail
+
+// f(thread, i) from threads threads at once, n calls each
+template<class F>
+void run_threads(harness & b, const std::string & suite, const std::string & name, const params & p,
+                 std::size_t threads, std::size_t n, F f)
+{
+  std::vector<histogram> hs(threads);
+  boost::thread_group group;
+  boost::uint64_t start = now_ns();
+  for (std::size_t t = 0; t < threads; ++t)
+  {
+    detail::thread_job<F> job = { f, t, n, hs[t] };
+    group.create_thread(job);
+  }
+  group.join_all();
+  double seconds = (now_ns() - start) / 1e9;
+  histogram h;
+  for (std::size_t t = 0; t < threads; ++t)
+    h.merge(hs[t]);
+  b.report(suite, name, p, h, seconds, threads * n);
+}
+
+// a ttserver of our own, on port, serving dbname ("*" for an on-memory hash, "path.tct" for a
+// table, and so on).  running() is false if it couldn't be started - ttserver isn't on the path,
+// say - and the rdb benchmarks skip themselves
+class ttserver : public boost::noncopyable
+{
+private:
+
+  pid_t pid_;
+
+  int port_;
+
+  bool running_;
+
+public:
+
+  ttserver(const std::string & dbname, int port)
+  : pid_(-1), port_(port), running_(false)
+  {
+    std::string port_s = boost::lexical_cast<std::string>(port);
+    pid_ = fork();
+    if (pid_ == 0)
+    {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, 1);
+      dup2(null, 2);
+      execlp("ttserver", "ttserver", "-port", port_s.c_str(), "-thnum", "8", dbname.c_str(), (char *) NULL);
+      _exit(127);
+    }
+    if (pid_ < 0)
+      return;
+    // wait for it to take connections
+    for (int i = 0; i < 100 && !running_; ++i)
+    {
+      int status = 0;
+      if (waitpid(pid_, &status, WNOHANG) == pid_)
+      {
+        pid_ = -1;
+        return;
+      }
+      TCRDB * r = tcrdbnew();
+      running_ = tcrdbopen(r, "127.0.0.1", port);
+      tcrdbdel(r);
+      if (!running_)
+        usleep(50000);
+    }
+  }
+
+  ~ttserver()
+  {
+    if (pid_ > 0)
+    {
+      kill(pid_, SIGTERM);
+      int status = 0;
+      waitpid(pid_, &status, 0);
+    }
+  }
+
+  bool running() const { return running_; }
+
+  int port() const { return port_; }
+};
+
+// the suites, one per file
+void hdb_benchmarks(harness & b);
+void codec_benchmarks(harness & b);
+void rdb_benchmarks(harness & b);
+void bdb_benchmarks(harness & b);
+void fdb_benchmarks(harness & b);
+void tdb_benchmarks(harness & b);
+void mdb_benchmarks(harness & b);
+
+} // bench
+
+#endif // __TOKYOOO_BENCH_HARNESS_HPP__
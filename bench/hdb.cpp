@@ -0,0 +1,259 @@
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <tokyooo/hdb.hpp>
+#include <tokyooo/sharded_hdb.hpp>
+#include <tokyooo/auto_tuned_hdb.hpp>
+#include <tokyooo/maintained_hdb.hpp>
+#include "harness.hpp"
+
+using namespace tokyooo;
+
+namespace bench {
+
+namespace {
+
+// enough records to be worth timing, but no more than about 256MB of values
+std::size_t records_for(harness & b, std::size_t value_size)
+{
+  return b.ops(std::max<std::size_t>(std::min<std::size_t>(100000, (256 << 20) / value_size), 64));
+}
+
+std::string name_of(hdb::tune_options_e opts)
+{
+  switch (opts)
+  {
+  case hdb::large: return "large";
+  case hdb::deflate: return "deflate";
+  case hdb::bzip: return "bzip";
+  case hdb::tcbs: return "tcbs";
+  default: return "default";
+  }
+}
+
+void basic_ops(harness & b)
+{
+  static const std::size_t sizes[] = { 8, 64, 1024, 16384, 1 << 20 };
+  for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+  {
+    std::size_t n = records_for(b, sizes[s]);
+    std::string value(sizes[s], 'x');
+    std::string path = b.path("basic_" + boost::lexical_cast<std::string>(sizes[s]) + ".tch");
+    hdb h(path, hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), false, n * 2);
+    params p;
+    p.set("value_size", sizes[s]).set("records", n);
+    run(b, "hdb", "put", p, n, [&](std::size_t i) { h.put(int(i), value); });
+    std::string out;
+    run(b, "hdb", "get", p, n, [&](std::size_t i) { h.get(int(i), out); });
+    run(b, "hdb", "iterate", p, 1, [&](std::size_t) {
+      std::size_t bytes = 0;
+      for (hdb::iterator it = h.begin(); it != h.end(); ++it)
+        bytes += it->value.size;
+    }, n);
+    run(b, "hdb", "out", p, n, [&](std::size_t i) { h.out(int(i)); });
+  }
+}
+
+// put and get of 64 byte values across the tuning parameters that matter
+void tuning(harness & b)
+{
+  std::size_t n = b.ops(100000);
+  std::string value(64, 'x');
+  static const boost::int64_t bnum_factors[] = { 0, 1, 4 }; // 0 is n / 4
+  static const char apows[] = { 4, 8 };
+  static const char fpows[] = { 10, 14 };
+  static const hdb::tune_options_e opts[] = { hdb::tune_default, hdb::large, hdb::deflate };
+  for (std::size_t bi = 0; bi < 3; ++bi)
+  for (std::size_t ai = 0; ai < 2; ++ai)
+  for (std::size_t fi = 0; fi < 2; ++fi)
+  for (std::size_t oi = 0; oi < 3; ++oi)
+  for (int mutexed = 0; mutexed < 2; ++mutexed)
+  {
+    boost::int64_t bnum = bnum_factors[bi] ? n * bnum_factors[bi] : n / 4;
+    hdb h(mutexed != 0, bnum, apows[ai], fpows[fi], opts[oi]);
+    h.open(b.path("tuning.tch"), hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc));
+    params p;
+    p.set("bnum", bnum).set("apow", int(apows[ai])).set("fpow", int(fpows[fi])).set("opts", name_of(opts[oi]))
+     .set("mutexed", mutexed ? "true" : "false").set("records", n);
+    run(b, "hdb_tuning", "put", p, n, [&](std::size_t i) { h.put(int(i), value); });
+    std::string out;
+    run(b, "hdb_tuning", "get", p, n, [&](std::size_t i) { h.get(int(i), out); });
+  }
+}
+
+// one put per call against the same puts grouped into transactions
+void batch(harness & b)
+{
+  std::size_t n = b.ops(100000);
+  std::string value(64, 'x');
+  static const hdb::open_options_e syncs[] = { hdb::open_default, hdb::synchronize };
+  for (std::size_t si = 0; si < 2; ++si)
+  {
+    // synchronized commits are slow enough to need fewer of them
+    std::size_t count = syncs[si] == hdb::synchronize ? std::max<std::size_t>(n / 100, 1) : n;
+    hdb::open_options_e options = hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc | syncs[si]);
+    params p;
+    p.set("value_size", 64).set("synchronize", syncs[si] ? "true" : "false").set("records", count);
+    {
+      hdb h(b.path("batch.tch"), options);
+      run(b, "hdb_batch", "put", p, count, [&](std::size_t i) { h.put(int(i), value); });
+    }
+    static const std::size_t flush_sizes[] = { 100, 4096 };
+    for (std::size_t fi = 0; fi < 2; ++fi)
+    {
+      hdb h(b.path("batch.tch"), options);
+      params bp = p;
+      bp.set("flush_size", flush_sizes[fi]);
+      hdb::batch w(h, flush_sizes[fi]);
+      run(b, "hdb_batch", "batch_put", bp, count, [&](std::size_t i) { w.put(int(i), value); });
+      w.commit();
+    }
+  }
+}
+
+// get against get_into and get_view, which shouldn't allocate
+void get_variants(harness & b)
+{
+  static const std::size_t sizes[] = { 16, 256, 4096 };
+  std::size_t n = b.ops(200000);
+  for (std::size_t s = 0; s < 3; ++s)
+  {
+    hdb h(b.path("get.tch"), hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), false, n * 2);
+    std::string value(sizes[s], 'x');
+    for (std::size_t i = 0; i < n; ++i)
+      h.put(int(i), value);
+    params p;
+    p.set("value_size", sizes[s]).set("records", n);
+    std::string out;
+    run(b, "hdb_get", "get", p, n, [&](std::size_t i) { h.get(int(i), out); });
+    std::vector<char> buffer(sizes[s]);
+    run(b, "hdb_get", "get_into", p, n, [&](std::size_t i) { h.get_into(int(i), &buffer[0], buffer.size()); });
+    view v;
+    run(b, "hdb_get", "get_view", p, n, [&](std::size_t i) { h.get_view(int(i), v); });
+  }
+}
+
+// writers from 1 to 64 threads against one mutexed hdb and against a sharded_hdb
+void scaling(harness & b)
+{
+  std::size_t n = b.ops(20000);
+  std::string value(64, 'x');
+  for (std::size_t threads = 1; threads <= 64; threads *= 2)
+  {
+    params p;
+    p.set("threads", threads).set("value_size", 64).set("records_per_thread", n);
+    {
+      hdb h(b.path("scaling.tch"), hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), true,
+            threads * n * 2);
+      run_threads(b, "hdb_scaling", "mutexed_put", p, threads, n,
+                  [&](std::size_t t, std::size_t i) { h.put(int(t * n + i), value); });
+    }
+    {
+      params sp = p;
+      sp.set("shards", 16);
+      sharded_hdb h(b.path("scaling_sharded.tch"), 16, hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc),
+                    threads * n * 2);
+      run_threads(b, "hdb_scaling", "sharded_put", sp, threads, n,
+                  [&](std::size_t t, std::size_t i) { h.put(int(t * n + i), value); });
+    }
+  }
+}
+
+// a file tuned for a 64th of what goes into it: left alone, and rebuilt as it grows.  put latency
+// shows what the rebuilds cost writers, get latency what they save afterwards
+void rebuild(harness & b)
+{
+  std::size_t n = b.ops(1000000);
+  std::string value(64, 'x');
+  std::size_t expected = std::max<std::size_t>(n / 64, 1);
+  params p;
+  p.set("value_size", 64).set("records", n).set("expected_records", expected);
+  {
+    hdb h(b.path("rebuild_fixed.tch"), hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), true,
+          hdb::tuning_for(expected, 64).bnum);
+    run(b, "hdb_rebuild", "fixed_put", p, n, [&](std::size_t i) { h.put(int(i), value); });
+    std::string out;
+    run(b, "hdb_rebuild", "fixed_get", p, n, [&](std::size_t i) { h.get(int(i), out); });
+  }
+  {
+    auto_tuned_hdb h(b.path("rebuild_auto.tch"), expected, 64,
+                     hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), 2,
+                     boost::posix_time::milliseconds(50));
+    run(b, "hdb_rebuild", "auto_put", p, n, [&](std::size_t i) { h.put(int(i), value); });
+    std::vector<auto_tuned_hdb::rebuild_report> reports = h.rebuilds();
+    boost::uint64_t copy_usec = 0, switch_usec = 0;
+    for (std::size_t i = 0; i < reports.size(); ++i)
+    {
+      copy_usec = std::max(copy_usec, reports[i].copy_usec);
+      switch_usec = std::max(switch_usec, reports[i].switch_usec);
+    }
+    params gp = p;
+    gp.set("rebuilds", reports.size()).set("max_copy_usec", copy_usec).set("max_switch_usec", switch_usec)
+      .set("bnum", h.bucket_count());
+    std::string out;
+    run(b, "hdb_rebuild", "auto_get", gp, n, [&](std::size_t i) { h.get(int(i), out); });
+  }
+}
+
+// churn - values that change size, so records move, and outs - which leaves holes in the file.  a
+// plain mutexed hdb against one with maintained_hdb syncing and defragmenting alongside
+void maintenance(harness & b)
+{
+  std::size_t n = b.ops(200000);
+  std::size_t keys = std::max<std::size_t>(n / 4, 1);
+  std::string small(32, 'x'), big(512, 'x');
+  params p;
+  p.set("records", n).set("keys", keys);
+  hdb::open_options_e options = hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc);
+  {
+    hdb h(b.path("maintenance_plain.tch"), options, true, keys * 2);
+    run(b, "hdb_maintenance", "plain_churn", p, n, [&](std::size_t i) {
+      if (i % 4 == 3)
+        h.try_out(int(i % keys));
+      else
+        h.put(int(i % keys), i % 2 ? big : small);
+    });
+  }
+  {
+    hdb h(b.path("maintenance_maintained.tch"), options, true, keys * 2);
+    maintained_hdb m(h, boost::posix_time::milliseconds(100), 4 << 20, 256, 0.05, 16);
+    run(b, "hdb_maintenance", "maintained_churn", p, n, [&](std::size_t i) {
+      if (i % 4 == 3)
+        m.try_out(int(i % keys));
+      else
+        m.put(int(i % keys), i % 2 ? big : small);
+    });
+    maintained_hdb::stats s = m.statistics();
+    params mp = p;
+    mp.set("syncs", s.syncs).set("defrag_steps", s.defrag_steps).set("reclaimed_bytes", s.reclaimed_bytes)
+      .set("max_pause_usec", s.max_pause_usec).set("max_defrag_usec", s.max_defrag_usec)
+      .set("free_blocks", s.free_blocks).set("fsize", s.fsize);
+    std::string out;
+    run(b, "hdb_maintenance", "maintained_get", mp, n, [&](std::size_t i) { m.get(int(i % keys), out); });
+  }
+}
+
+} // anonymous
+
+void hdb_benchmarks(harness & b)
+{
+  if (b.wants("hdb"))
+    basic_ops(b);
+  if (b.wants("hdb_tuning"))
+    tuning(b);
+  if (b.wants("hdb_batch"))
+    batch(b);
+  if (b.wants("hdb_get"))
+    get_variants(b);
+  if (b.wants("hdb_scaling"))
+    scaling(b);
+  if (b.wants("hdb_rebuild"))
+    rebuild(b);
+  if (b.wants("hdb_maintenance"))
+    maintenance(b);
+}
+
+} // bench
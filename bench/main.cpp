@@ -0,0 +1,46 @@
+#include <string>
+#include <iostream>
+#include <cstring>
+
+#include "harness.hpp"
+
+namespace bench {
+
+volatile std::size_t sink;
+
+} // bench
+
+// bench [--quick] [filter]
+//
+// runs every suite whose name contains filter (all of them without one) and writes the results to
+// stdout as json.  progress goes to stderr.  the rdb, query and tdb_query suites start their own
+// ttserver, so it has to be on the path.
+int main(int argc, char * argv[])
+{
+  bool quick = false;
+  std::string filter;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "--quick") == 0)
+      quick = true;
+    else if (std::strcmp(argv[i], "--help") == 0)
+    {
+      std::cerr << "usage: " << argv[0] << " [--quick] [filter]" << std::endl
+                << "suites: hdb hdb_tuning hdb_batch hdb_get hdb_scaling hdb_rebuild bdb bdb_prefix fdb" << std::endl
+                << "        hdb_maintenance mdb_scaling mdb_capacity codec map list" << std::endl
+                << "        rdb rdb_many rdb_pool async_rdb rdb_layered query tdb_query" << std::endl;
+      return 0;
+    }
+    else
+      filter = argv[i];
+  }
+  bench::harness b(std::cout, filter, quick);
+  bench::codec_benchmarks(b);
+  bench::hdb_benchmarks(b);
+  bench::bdb_benchmarks(b);
+  bench::fdb_benchmarks(b);
+  bench::mdb_benchmarks(b);
+  bench::rdb_benchmarks(b);
+  bench::tdb_benchmarks(b);
+  return 0;
+}
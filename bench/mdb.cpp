@@ -0,0 +1,142 @@
+#include <string>
+#include <mutex>
+
+#include <tokyooo/mdb.hpp>
+#include <tokyooo/ndb.hpp>
+#include <tokyooo/map.hpp>
+#include "harness.hpp"
+
+using namespace tokyooo;
+
+namespace bench {
+
+namespace {
+
+// one in ten calls is a put, the rest gets, spread over keys keys
+bool is_put(std::size_t t, std::size_t i)
+{
+  return (t * 7919 + i) % 10 == 0;
+}
+
+int key_of(std::size_t t, std::size_t i, std::size_t keys)
+{
+  return int((t * 104729 + i * 7919) % keys);
+}
+
+// what each thread's gets sink, a cache line apart so the threads don't share one.  fold() moves
+// them into sink once the threads are done
+struct alignas(64) thread_sink
+{
+  std::size_t n;
+};
+
+void fold(thread_sink * sinks, std::size_t threads)
+{
+  for (std::size_t t = 0; t < threads; ++t)
+  {
+    sink += sinks[t].n;
+    sinks[t].n = 0;
+  }
+}
+
+// a shared in-process store from 1 to 32 threads: mdb's striped locks, ndb's single one, and a
+// tokyooo::map behind a std::mutex, which is what sharing one takes without them
+void scaling(harness & b)
+{
+  const std::size_t keys = 100000;
+  std::size_t n = b.ops(100000);
+  std::string value(64, 'x');
+  for (std::size_t threads = 1; threads <= 32; threads *= 2)
+  {
+    params p;
+    p.set("threads", threads).set("keys", keys).set("value_size", 64).set("put_percent", 10);
+    thread_sink sinks[32] = {};
+    {
+      mdb m;
+      for (std::size_t k = 0; k < keys; ++k)
+        m.put(int(k), value);
+      run_threads(b, "mdb_scaling", "mdb", p, threads, n, [&](std::size_t t, std::size_t i) {
+        int k = key_of(t, i, keys);
+        if (is_put(t, i))
+          m.put(k, value);
+        else
+        {
+          std::string out;
+          m.get(k, out);
+          sinks[t].n += out.size();
+        }
+      });
+      fold(sinks, threads);
+    }
+    {
+      ndb m;
+      for (std::size_t k = 0; k < keys; ++k)
+        m.put(int(k), value);
+      run_threads(b, "mdb_scaling", "ndb", p, threads, n, [&](std::size_t t, std::size_t i) {
+        int k = key_of(t, i, keys);
+        if (is_put(t, i))
+          m.put(k, value);
+        else
+        {
+          std::string out;
+          m.get(k, out);
+          sinks[t].n += out.size();
+        }
+      });
+      fold(sinks, threads);
+    }
+    {
+      map m;
+      std::mutex mutex;
+      for (std::size_t k = 0; k < keys; ++k)
+        m.put(int(k), value);
+      run_threads(b, "mdb_scaling", "locked_map", p, threads, n, [&](std::size_t t, std::size_t i) {
+        int k = key_of(t, i, keys);
+        if (is_put(t, i))
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          m.put(k, value);
+        }
+        else
+        {
+          std::string out;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            m.get(k, out);
+          }
+          sinks[t].n += out.size();
+        }
+      });
+      fold(sinks, threads);
+    }
+  }
+}
+
+// puts of new keys into a full mdb, so every one of them evicts
+void capacity(harness & b)
+{
+  std::size_t n = b.ops(200000);
+  std::string value(64, 'x');
+  static const std::size_t capacities[] = { 1000, 100000 };
+  for (std::size_t ci = 0; ci < 2; ++ci)
+  {
+    params p;
+    p.set("max_records", capacities[ci]).set("value_size", 64);
+    mdb m(0, capacities[ci]);
+    run(b, "mdb_capacity", "mdb_put", p, n, [&](std::size_t i) { m.put(int(i), value); });
+    ndb t(capacities[ci]);
+    run(b, "mdb_capacity", "ndb_put", p, n, [&](std::size_t i) { t.put(int(i), value); });
+  }
+}
+
+} // anonymous
+
+void mdb_benchmarks(harness & b)
+{
+  if (b.wants("mdb_scaling"))
+    scaling(b);
+  if (b.wants("mdb_capacity"))
+    capacity(b);
+}
+
+} // bench
@@ -0,0 +1,230 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
+
+#include <tokyooo/rdb.hpp>
+#include <tokyooo/query.hpp>
+#include <tokyooo/rdb_pool.hpp>
+#include <tokyooo/async_rdb.hpp>
+#include <tokyooo/cached_rdb.hpp>
+#include <tokyooo/write_behind_rdb.hpp>
+#include "harness.hpp"
+
+using namespace tokyooo;
+
+namespace bench {
+
+namespace {
+
+// well away from tyrant's default, so a server already running on this box isn't touched
+const int hash_port = 19780;
+const int table_port = 19781;
+
+void basic_ops(harness & b, int port)
+{
+  rdb r("127.0.0.1", port);
+  static const std::size_t sizes[] = { 8, 256, 4096 };
+  for (std::size_t s = 0; s < 3; ++s)
+  {
+    std::size_t n = b.ops(50000);
+    std::string value(sizes[s], 'x');
+    params p;
+    p.set("value_size", sizes[s]);
+    run(b, "rdb", "put", p, n, [&](std::size_t i) { r.put(int(i), value); });
+    run(b, "rdb", "put_nr", p, n, [&](std::size_t i) { r.put(int(i), value, nr); });
+    std::string out;
+    run(b, "rdb", "get", p, n, [&](std::size_t i) { r.get(int(i), out); });
+    view v;
+    run(b, "rdb", "get_view", p, n, [&](std::size_t i) { r.get_view(int(i), v); });
+    run(b, "rdb", "out", p, n, [&](std::size_t i) { r.out(int(i)); });
+  }
+}
+
+// keys/sec through the *_many calls at different batch sizes
+void many(harness & b, int port)
+{
+  rdb r("127.0.0.1", port);
+  static const std::size_t batches[] = { 1, 10, 100, 1000 };
+  std::size_t total = b.ops(100000);
+  for (std::size_t bi = 0; bi < 4; ++bi)
+  {
+    std::size_t per = batches[bi];
+    std::size_t calls = std::max<std::size_t>(total / per, 1);
+    std::vector< std::pair<int, std::string> > items;
+    std::vector<int> keys;
+    for (std::size_t i = 0; i < per; ++i)
+    {
+      items.push_back(std::make_pair(int(i), std::string(64, 'x')));
+      keys.push_back(int(i));
+    }
+    params p;
+    p.set("keys_per_call", per).set("value_size", 64);
+    run(b, "rdb_many", "put_many", p, calls, [&](std::size_t) { r.put_many(items.begin(), items.end()); }, per);
+    std::map<int, std::string> out;
+    run(b, "rdb_many", "get_many", p, calls, [&](std::size_t) {
+      out.clear();
+      r.get_many(keys.begin(), keys.end(), out);
+    }, per);
+    run(b, "rdb_many", "out_many", p, calls, [&](std::size_t) { r.out_many(keys.begin(), keys.end()); }, per);
+  }
+}
+
+void queries(harness & b, int port)
+{
+  rdb r("127.0.0.1", port);
+  std::size_t rows = b.ops(100000);
+  r.set_index("n", rdb::decimal);
+  for (std::size_t i = 0; i < rows; ++i)
+  {
+    map row;
+    row.put(std::string("n"), boost::lexical_cast<std::string>(i));
+    row.put(std::string("s"), std::string("row ") + boost::lexical_cast<std::string>(i % 100));
+    r.tbl_put(boost::lexical_cast<std::string>(i), row);
+  }
+  static const int limits[] = { 10, 100, 1000 };
+  for (std::size_t li = 0; li < 3; ++li)
+  {
+    params p;
+    p.set("rows", rows).set("limit", limits[li]);
+    std::size_t n = b.ops(2000);
+    run(b, "query", "search_keys", p, n, [&](std::size_t i) {
+      query q(r);
+      q.cond("n", query::num_greater_equal, boost::lexical_cast<std::string>(i % rows))
+       .order("n", query::num_asc).limit(limits[li], 0);
+      list keys;
+      q.search_keys(keys);
+    });
+    run(b, "query", "search_rows", p, n, [&](std::size_t i) {
+      query q(r);
+      q.cond("n", query::num_greater_equal, boost::lexical_cast<std::string>(i % rows))
+       .order("n", query::num_asc).limit(limits[li], 0);
+      list found;
+      q.search_rows(found);
+    });
+  }
+  params p;
+  p.set("rows", rows).set("page_size", 1000);
+  run(b, "query", "cursor_walk", p, 1, [&](std::size_t) {
+    query q(r);
+    q.order("n", query::num_asc);
+    query::cursor c(q, 1000, query::cursor::keys, query::cursor::by_order);
+    std::string key;
+    while (c.next_key(key))
+      ;
+  }, rows);
+}
+
+// threads sharing a pool, up to twice the pool's size
+void pool(harness & b, int port)
+{
+  const std::size_t pool_size = 16;
+  rdb_pool connections("127.0.0.1", port, pool_size, pool_size);
+  std::string value(64, 'x');
+  std::size_t n = b.ops(10000);
+  for (std::size_t threads = 1; threads <= pool_size * 2; threads *= 2)
+  {
+    params p;
+    p.set("threads", threads).set("pool_size", pool_size).set("value_size", 64);
+    run_threads(b, "rdb_pool", "put", p, threads, n, [&](std::size_t t, std::size_t i) {
+      rdb_pool::lease r(connections);
+      r->put(int(t * n + i), value);
+    });
+  }
+  rdb_pool::stats s = connections.statistics();
+  std::cerr << "rdb_pool: " << s.waited << " of " << s.acquired << " leases waited" << std::endl;
+}
+
+// requests kept in flight on one connection, 1 to 256 deep
+void pipelined(harness & b, int port)
+{
+  async_rdb r("127.0.0.1", port);
+  std::string value(64, 'x');
+  std::size_t total = b.ops(200000);
+  for (std::size_t depth = 1; depth <= 256; depth *= 2)
+  {
+    params p;
+    p.set("depth", depth).set("value_size", 64);
+    std::size_t calls = std::max<std::size_t>(total / depth, 1);
+    std::vector< async_rdb::future<bool>::type > puts(depth);
+    run(b, "async_rdb", "put", p, calls, [&](std::size_t i) {
+      for (std::size_t d = 0; d < depth; ++d)
+        puts[d] = r.put(int(i * depth + d) % 100000, value);
+      for (std::size_t d = 0; d < depth; ++d)
+        puts[d].get();
+    }, depth);
+    std::vector< async_rdb::future< boost::optional<std::string> >::type > gets(depth);
+    run(b, "async_rdb", "get", p, calls, [&](std::size_t i) {
+      for (std::size_t d = 0; d < depth; ++d)
+        gets[d] = r.get<std::string>(int(i * depth + d) % 100000);
+      for (std::size_t d = 0; d < depth; ++d)
+        gets[d].get();
+    }, depth);
+  }
+}
+
+// a hot set of keys read through the cache, and overwritten through write-behind
+void layered(harness & b, int port)
+{
+  rdb r("127.0.0.1", port);
+  std::string value(64, 'x');
+  const int hot = 1000;
+  for (int i = 0; i < hot; ++i)
+    r.put(i, value);
+  std::size_t n = b.ops(200000);
+  {
+    cached_rdb c(r, hot * 2);
+    params p;
+    p.set("hot_keys", hot).set("value_size", 64);
+    std::string out;
+    run(b, "rdb_layered", "cached_get", p, n, [&](std::size_t i) { c.get(int(i % hot), out); });
+    cached_rdb::stats s = c.statistics();
+    std::cerr << "cached_rdb: " << s.hits << " hits, " << s.misses << " misses" << std::endl;
+  }
+  {
+    write_behind_rdb w(r);
+    params p;
+    p.set("hot_keys", hot).set("value_size", 64);
+    run(b, "rdb_layered", "write_behind_put", p, n, [&](std::size_t i) { w.put(int(i % hot), value); });
+    run(b, "rdb_layered", "write_behind_close", p, 1, [&](std::size_t) { w.close(); });
+    write_behind_rdb::stats s = w.statistics();
+    std::cerr << "write_behind_rdb: " << s.coalesced << " of " << s.writes << " writes coalesced" << std::endl;
+  }
+}
+
+} // anonymous
+
+void rdb_benchmarks(harness & b)
+{
+  if (b.wants("rdb") || b.wants("rdb_many") || b.wants("rdb_pool") || b.wants("async_rdb") || b.wants("rdb_layered"))
+  {
+    ttserver server("*", hash_port);
+    if (!server.running())
+      std::cerr << "bench: couldn't start ttserver, skipping the rdb benchmarks" << std::endl;
+    else
+    {
+      if (b.wants("rdb"))
+        basic_ops(b, hash_port);
+      if (b.wants("rdb_many"))
+        many(b, hash_port);
+      if (b.wants("rdb_pool"))
+        pool(b, hash_port);
+      if (b.wants("async_rdb"))
+        pipelined(b, hash_port);
+      if (b.wants("rdb_layered"))
+        layered(b, hash_port);
+    }
+  }
+  if (b.wants("query"))
+  {
+    ttserver server(b.path("query.tct"), table_port);
+    if (server.running())
+      queries(b, table_port);
+  }
+}
+
+} // bench
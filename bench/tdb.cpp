@@ -0,0 +1,107 @@
+#include <string>
+#include <iostream>
+
+#include <boost/lexical_cast.hpp>
+
+#include <tokyooo/tdb.hpp>
+#include <tokyooo/rdb.hpp>
+#include <tokyooo/query.hpp>
+#include "harness.hpp"
+
+using namespace tokyooo;
+
+namespace bench {
+
+namespace {
+
+// clear of the ports in rdb.cpp
+const int table_port = 19782;
+
+void fill(map & row, std::size_t i)
+{
+  row.put(std::string("n"), boost::lexical_cast<std::string>(i));
+  row.put(std::string("s"), std::string("row ") + boost::lexical_cast<std::string>(i % 100));
+}
+
+// the same rows, index and query chains in a tdb here and in a table served by ttserver, so the
+// difference is the round trip and what tyrant does around it
+void compare(harness & b)
+{
+  std::size_t rows = b.ops(100000);
+  tdb local(b.path("query.tct"), tdb::open_options_e(tdb::writer | tdb::create | tdb::trunc));
+  rdb remote("127.0.0.1", table_port);
+  remote.vanish();
+  local.set_index("n", tdb::decimal);
+  remote.set_index("n", rdb::decimal);
+  params p;
+  p.set("rows", rows);
+  run(b, "tdb_query", "local_tbl_put", p, rows, [&](std::size_t i) {
+    map row;
+    fill(row, i);
+    local.tbl_put(boost::lexical_cast<std::string>(i), row);
+  });
+  run(b, "tdb_query", "remote_tbl_put", p, rows, [&](std::size_t i) {
+    map row;
+    fill(row, i);
+    remote.tbl_put(boost::lexical_cast<std::string>(i), row);
+  });
+  std::size_t n = b.ops(20000);
+  map row;
+  run(b, "tdb_query", "local_tbl_get", p, n, [&](std::size_t i) {
+    local.tbl_get(boost::lexical_cast<std::string>(i % rows), row);
+  });
+  run(b, "tdb_query", "remote_tbl_get", p, n, [&](std::size_t i) {
+    remote.tbl_get(boost::lexical_cast<std::string>(i % rows), row);
+  });
+  static const int limits[] = { 10, 100, 1000 };
+  for (std::size_t li = 0; li < 3; ++li)
+  {
+    params lp;
+    lp.set("rows", rows).set("limit", limits[li]);
+    std::size_t searches = b.ops(2000);
+    run(b, "tdb_query", "local_search_keys", lp, searches, [&](std::size_t i) {
+      tdb_query q(local);
+      q.cond("n", query::num_greater_equal, boost::lexical_cast<std::string>(i % rows))
+       .order("n", query::num_asc).limit(limits[li], 0);
+      list keys;
+      q.search_keys(keys);
+    });
+    run(b, "tdb_query", "remote_search_keys", lp, searches, [&](std::size_t i) {
+      query q(remote);
+      q.cond("n", query::num_greater_equal, boost::lexical_cast<std::string>(i % rows))
+       .order("n", query::num_asc).limit(limits[li], 0);
+      list keys;
+      q.search_keys(keys);
+    });
+    run(b, "tdb_query", "local_search_rows", lp, searches, [&](std::size_t i) {
+      tdb_query q(local);
+      q.cond("n", query::num_greater_equal, boost::lexical_cast<std::string>(i % rows))
+       .order("n", query::num_asc).limit(limits[li], 0);
+      list found;
+      q.search_rows(found);
+    });
+    run(b, "tdb_query", "remote_search_rows", lp, searches, [&](std::size_t i) {
+      query q(remote);
+      q.cond("n", query::num_greater_equal, boost::lexical_cast<std::string>(i % rows))
+       .order("n", query::num_asc).limit(limits[li], 0);
+      list found;
+      q.search_rows(found);
+    });
+  }
+}
+
+} // anonymous
+
+void tdb_benchmarks(harness & b)
+{
+  if (b.wants("tdb_query"))
+  {
+    ttserver server(b.path("served.tct"), table_port);
+    if (!server.running())
+      std::cerr << "bench: couldn't start ttserver, skipping the tdb benchmarks" << std::endl;
+    else
+      compare(b);
+  }
+}
+
+} // bench
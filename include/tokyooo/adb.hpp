@@ -0,0 +1,387 @@
+#ifndef __TOKYOOO_ADB_HPP__
+#define __TOKYOOO_ADB_HPP__
+
+#include <string>
+#include <limits>
+#include <malloc.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <tcutil.h>
+#include <tcadb.h>
+#include "util.hpp"
+#include "list.hpp"
+#include "stats.hpp"
+#include "store.hpp"
+
+namespace tokyooo {
+
+// the abstract database: one type in front of whichever database its name picks when it's opened -
+//
+//   "*"                  on-memory hash (tcmdb)
+//   "+"                  on-memory tree (tcndb)
+//   "path.tch#bnum=..."  hash file, "path.tcb" b+ tree, "path.tcf" fixed-length, "path.tct" table
+//
+// with the tuning after the #, as tcadbopen takes it.  it's a Store (see store.hpp), for when the
+// backend is only known at run time; every call goes through a switch inside tcadb, so when it's
+// known at compile time use hdb, bdb and the rest directly.  tcadb keeps no error code, so the
+// try_ calls work out what happened from the call that failed: a miss is not_found(), a keep on a
+// record that's there exists(), and the rest are TCEMISC.
+template<class Stats = no_stats>
+class basic_adb : public boost::noncopyable
+{
+private:
+
+  TCADB * adb_;
+
+  std::string name_;
+
+  Stats stats_;
+
+  result outcome(bool ok, int code, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(code);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+  void check(bool ok, const char * call)
+  {
+    ok || err::go(std::string("tokyooo: adb ") + call + " failed on " + name_);
+  }
+
+public:
+
+  basic_adb()
+  : adb_(tcadbnew()) {}
+
+  explicit basic_adb(const std::string & name)
+  : adb_(tcadbnew())
+  {
+    open(name);
+  }
+
+  ~basic_adb()
+  {
+    tcadbclose(adb_);
+    tcadbdel(adb_);
+  }
+
+  void open(const std::string & name)
+  {
+    typename Stats::timer t(stats_, op_open);
+    name_ = name;
+    check(tcadbopen(adb_, name.c_str()), "open");
+  }
+
+  void close()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    check(tcadbclose(adb_), "close");
+  }
+
+  // store, keep or cat
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    result r = try_put(key, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    result r = try_get(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    result r = try_get_view(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    int ret_val = -1;
+    result r = try_vsize(key, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key), v(value);
+    t.add_bytes(k.size() + v.size());
+    bool ok = false;
+    switch (put_mode)
+    {
+    case store: ok = tcadbput(adb_, k.data(), k.size(), v.data(), v.size()); break;
+    case keep: ok = tcadbputkeep(adb_, k.data(), k.size(), v.data(), v.size()); break;
+    case cat: ok = tcadbputcat(adb_, k.data(), k.size(), v.data(), v.size()); break;
+    default: err::go("expardon me?"); break;
+    }
+    return outcome(ok, put_mode == keep ? TCEKEEP : TCEMISC, t);
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tcadbout(adb_, k.data(), k.size()), TCENOREC, t);
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    int size = 0;
+    void * p = tcadbget(adb_, k.data(), k.size(), &size);
+    if (p == NULL)
+      return outcome(false, TCENOREC, t);
+    t.add_bytes(size);
+    try
+    {
+      unpack(value, p, size);
+    }
+    catch (...)
+    {
+      std::free(p);
+      throw;
+    }
+    std::free(p);
+    return result();
+  }
+
+  // tcadb only hands back malloc'd copies, so this copies once more, into the thread's buffer
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    int size = 0;
+    void * p = tcadbget(adb_, k.data(), k.size(), &size);
+    if (p == NULL)
+      return outcome(false, TCENOREC, t);
+    t.add_bytes(size);
+    std::vector<char> & buffer = thread_buffer();
+    if (size > static_cast<int>(buffer.size()))
+      buffer.resize(size);
+    std::memcpy(&buffer[0], p, size);
+    std::free(p);
+    value = view(&buffer[0], size);
+    return result();
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcadbvsiz(adb_, k.data(), k.size());
+    if (got == -1)
+      return outcome(false, TCENOREC, t);
+    size = got;
+    return result();
+  }
+
+  // a record that's there but isn't the size of the number is exists(), as it is from tchdb
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcadbaddint(adb_, k.data(), k.size(), value);
+    if (got == std::numeric_limits<int>::min())
+      return outcome(false, TCEKEEP, t);
+    sum = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    double got = tcadbadddouble(adb_, k.data(), k.size(), value);
+    if (std::isnan(got))
+      return outcome(false, TCEKEEP, t);
+    sum = got;
+    return result();
+  }
+
+  // the keys starting with prefix, up to max of them (-1 for all).  in key order on a tree, in no
+  // particular order otherwise
+  void prefix(const std::string & prefix, list & keys, int max = -1)
+  {
+    typename Stats::timer t(stats_, op_iterate);
+    list tmp( tcadbfwmkeys(adb_, prefix.data(), prefix.size(), max) );
+    keys.swap(tmp);
+  }
+
+  // whatever the backend does by that name - see tcadbmisc
+  void misc(const std::string & name, list & args, list & result)
+  {
+    typename Stats::timer t(stats_, op_misc);
+    list tmp( tcadbmisc(adb_, name.c_str(), args.native()) );
+    if (!tmp.native())
+      check(false, "misc");
+    result.swap(tmp);
+  }
+
+  // one transaction at a time.  the on-memory databases have none, and throw here
+  class transaction : public boost::noncopyable
+  {
+  private:
+
+    basic_adb & adb_;
+
+    bool open_;
+
+  public:
+
+    explicit transaction(basic_adb & a)
+    : adb_(a), open_(false)
+    {
+      adb_.check(tcadbtranbegin(adb_.native()), "transaction");
+      open_ = true;
+    }
+
+    ~transaction()
+    {
+      if (open_)
+        tcadbtranabort(adb_.native());
+    }
+
+    void commit()
+    {
+      typename Stats::timer t(adb_.stats(), op_misc);
+      open_ = false;
+      adb_.check(tcadbtrancommit(adb_.native()), "commit");
+    }
+
+    void abort()
+    {
+      open_ = false;
+      adb_.check(tcadbtranabort(adb_.native()), "abort");
+    }
+  };
+
+  void sync()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    check(tcadbsync(adb_), "sync");
+  }
+
+  // params is the tuning, as after the # in the name
+  void optimize(const std::string & params = "")
+  {
+    typename Stats::timer t(stats_, op_admin);
+    check(tcadboptimize(adb_, params.c_str()), "optimize");
+  }
+
+  void vanish()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    check(tcadbvanish(adb_), "vanish");
+  }
+
+  void copy(const std::string & path)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    check(tcadbcopy(adb_, path.c_str()), "copy");
+  }
+
+  // "*" or "+" for the on-memory databases
+  std::string path()
+  {
+    const char * ret_val = tcadbpath(adb_);
+    return ret_val ? std::string(ret_val) : std::string();
+  }
+
+  size_type size()
+  {
+    return tcadbrnum(adb_);
+  }
+
+  // the file's size, or the memory used by an on-memory database
+  size_type fsize()
+  {
+    return tcadbsize(adb_);
+  }
+
+  TCADB * native()
+  {
+    return adb_;
+  }
+
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+};
+
+template<class Stats>
+struct supports_transactions< basic_adb<Stats> > : boost::true_type {};
+
+typedef basic_adb<> adb;
+
+BOOST_CONCEPT_ASSERT((Store<adb>));
+
+} // tokyooo
+
+#endif // __TOKYOOO_ADB_HPP__
@@ -0,0 +1,592 @@
+#ifndef __TOKYOOO_ASYNC_RDB_HPP__
+#define __TOKYOOO_ASYNC_RDB_HPP__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/future.hpp>
+
+#include "util.hpp"
+#include "list.hpp"
+#include "rdb.hpp"
+
+namespace tokyooo {
+
+// a tyrant client that doesn't wait for answers.  it speaks the binary protocol itself over one
+// non-blocking socket, so any number of requests can be on the wire at once: every call writes its
+// request and returns a future straight away, and an epoll thread matches replies to futures as
+// they come back (tyrant answers in order).
+//
+//   async_rdb r("localhost", 1978);
+//   async_rdb::future< boost::optional<std::string> >::type f = r.get<std::string>(key);
+//   ...
+//   if (f.get()) ...
+//
+// keys and values go through codec<> the same as rdb.  if the connection drops, everything in
+// flight and everything after fails with an exception in its future.  linux only (epoll), and it
+// wants a c++11 compiler - boost's futures can't be returned by value under c++03.
+class async_rdb : public boost::noncopyable
+{
+public:
+
+  // boost::unique_future, or boost::future if you've asked boost.thread for the newer interface
+  template<class T>
+  struct future
+  {
+    typedef boost::BOOST_THREAD_FUTURE<T> type;
+  };
+
+private:
+
+  enum command_e
+  {
+    cmd_put = 0x10,
+    cmd_putkeep = 0x11,
+    cmd_putcat = 0x12,
+    cmd_putshl = 0x13,
+    cmd_putnr = 0x18,
+    cmd_out = 0x20,
+    cmd_get = 0x30,
+    cmd_addint = 0x60,
+    cmd_misc = 0x90
+  };
+
+  static void put_int32(std::vector<char> & out, boost::uint32_t n)
+  {
+    char b[4] = { char(n >> 24), char(n >> 16), char(n >> 8), char(n) };
+    out.insert(out.end(), b, b + 4);
+  }
+
+  static boost::uint32_t get_int32(const char * p)
+  {
+    const unsigned char * u = reinterpret_cast<const unsigned char *>(p);
+    return (boost::uint32_t(u[0]) << 24) | (boost::uint32_t(u[1]) << 16) | (boost::uint32_t(u[2]) << 8) | u[3];
+  }
+
+  static void put_bytes(std::vector<char> & out, const void * p, int size)
+  {
+    out.insert(out.end(), reinterpret_cast<const char *>(p), reinterpret_cast<const char *>(p) + size);
+  }
+
+  // one request waiting for its reply.  parse() consumes the reply and returns true once all of it
+  // is in [p, end), or leaves p alone and returns false if it isn't yet
+  struct pending : public boost::noncopyable
+  {
+    virtual ~pending() {}
+    virtual bool parse(const char * & p, const char * end) = 0;
+    virtual void fail(const std::string & message) = 0;
+  };
+
+  template<class T>
+  struct promised : public pending
+  {
+    boost::promise<T> promise;
+
+    void fail(const std::string & message)
+    {
+      promise.set_exception(boost::copy_exception(std::runtime_error(message)));
+    }
+  };
+
+  // put*, out: just a status byte.  non-zero means keep found a record or out didn't
+  struct status_reply : public promised<bool>
+  {
+    bool parse(const char * & p, const char * end)
+    {
+      if (end - p < 1)
+        return false;
+      promise.set_value(*p++ == 0);
+      return true;
+    }
+  };
+
+  template<class Value>
+  struct get_reply : public promised< boost::optional<Value> >
+  {
+    bool parse(const char * & p, const char * end)
+    {
+      if (end - p < 1)
+        return false;
+      if (*p != 0)
+      {
+        ++p;
+        this->promise.set_value(boost::optional<Value>());
+        return true;
+      }
+      if (end - p < 5 || end - p - 5 < static_cast<std::ptrdiff_t>(get_int32(p + 1)))
+        return false;
+      int size = get_int32(p + 1);
+      try
+      {
+        Value value;
+        unpack(value, p + 5, size);
+        this->promise.set_value(boost::optional<Value>(value));
+      }
+      catch (std::exception & e)
+      {
+        this->fail(e.what());
+      }
+      p += 5 + size;
+      return true;
+    }
+  };
+
+  struct addint_reply : public promised<int>
+  {
+    bool parse(const char * & p, const char * end)
+    {
+      if (end - p < 1)
+        return false;
+      if (*p != 0)
+      {
+        ++p;
+        fail("tokyooo: addint failed - existing record isn't an int?");
+        return true;
+      }
+      if (end - p < 5)
+        return false;
+      promise.set_value(static_cast<int>(get_int32(p + 1)));
+      p += 5;
+      return true;
+    }
+  };
+
+  // a failed call is just the status byte, as tcrdbmisc reads it; the count and list only follow
+  // a success
+  struct misc_reply : public promised<list>
+  {
+    bool parse(const char * & p, const char * end)
+    {
+      if (end - p < 1)
+        return false;
+      if (*p != 0)
+      {
+        ++p;
+        fail("tokyooo: misc function failed");
+        return true;
+      }
+      if (end - p < 5)
+        return false;
+      boost::uint32_t rnum = get_int32(p + 1);
+      const char * q = p + 5;
+      for (boost::uint32_t i = 0; i < rnum; ++i)
+      {
+        if (end - q < 4 || end - q - 4 < static_cast<std::ptrdiff_t>(get_int32(q)))
+          return false;
+        q += 4 + get_int32(q);
+      }
+      list result;
+      for (q = p + 5; rnum--; q += 4 + get_int32(q))
+        tclistpush(result.native(), q + 4, get_int32(q));
+      p = q;
+      promise.set_value(result);
+      return true;
+    }
+  };
+
+  int sock_;
+
+  int wake_;
+
+  int epoll_;
+
+  boost::mutex mutex_;
+
+  boost::condition_variable drained_;
+
+  std::vector<char> out_;        // requests not yet picked up by the io thread
+
+  std::deque<pending *> inflight_;
+
+  std::size_t max_inflight_;
+
+  std::string error_;            // set once the connection is dead
+
+  bool wake_needed_;
+
+  bool stopping_;
+
+  boost::thread thread_;
+
+  // requests are encoded straight into out_, so everything from begin_request() to submit() holds
+  // the lock.  that keeps the bytes on the wire in the same order as inflight_
+  std::vector<char> & begin_request(boost::mutex::scoped_lock & lock, command_e cmd)
+  {
+    while (max_inflight_ && inflight_.size() >= max_inflight_ && error_.empty())
+      drained_.wait(lock);
+    wake_needed_ = out_.empty();
+    out_.push_back(char(0xc8));
+    out_.push_back(char(cmd));
+    return out_;
+  }
+
+  // r is what'll parse the reply, or null if there won't be one
+  void submit(pending * r)
+  {
+    if (!error_.empty())
+    {
+      out_.clear();
+      if (r)
+      {
+        r->fail(error_);
+        delete r;
+      }
+      return;
+    }
+    if (r)
+      inflight_.push_back(r);
+    // if out_ already had something in it the io thread has been told about it
+    if (wake_needed_)
+    {
+      boost::uint64_t one = 1;
+      ssize_t ignored = ::write(wake_, &one, sizeof(one));
+      (void) ignored;
+    }
+  }
+
+  void fail_all(const std::string & message)
+  {
+    std::deque<pending *> failed;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (error_.empty())
+        error_ = message;
+      failed.swap(inflight_);
+      out_.clear();
+    }
+    drained_.notify_all();
+    for (std::deque<pending *>::iterator it = failed.begin(); it != failed.end(); ++it)
+    {
+      (*it)->fail(message);
+      delete *it;
+    }
+  }
+
+  void run()
+  {
+    std::vector<char> sending, received;
+    std::size_t sent = 0;
+    bool want_write = false;
+    char chunk[65536];
+    for (;;)
+    {
+      epoll_event events[2];
+      int n = ::epoll_wait(epoll_, events, 2, -1);
+      if (n < 0 && errno != EINTR)
+      {
+        fail_all(std::string("tokyooo: epoll_wait: ") + std::strerror(errno));
+        return;
+      }
+      bool readable = false, writable = false, broken = false;
+      for (int i = 0; i < n; ++i)
+      {
+        if (events[i].data.fd == wake_)
+        {
+          boost::uint64_t count;
+          ssize_t ignored = ::read(wake_, &count, sizeof(count));
+          (void) ignored;
+          continue;
+        }
+        readable = readable || (events[i].events & EPOLLIN);
+        writable = writable || (events[i].events & EPOLLOUT);
+        broken = broken || (events[i].events & (EPOLLERR | EPOLLHUP));
+      }
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (stopping_)
+          break;
+        if (sent == sending.size() && !out_.empty())
+        {
+          sending.swap(out_);
+          out_.clear();
+          sent = 0;
+          writable = true;
+        }
+      }
+      while (writable && sent < sending.size())
+      {
+        ssize_t w = ::send(sock_, &sending[sent], sending.size() - sent, MSG_NOSIGNAL);
+        if (w > 0)
+          sent += w;
+        else if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          break;
+        else if (w < 0 && errno != EINTR)
+        {
+          fail_all(std::string("tokyooo: send: ") + std::strerror(errno));
+          return;
+        }
+      }
+      if (readable || broken)
+      {
+        for (;;)
+        {
+          ssize_t r = ::recv(sock_, chunk, sizeof(chunk), 0);
+          if (r > 0)
+            received.insert(received.end(), chunk, chunk + r);
+          else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+          else if (r < 0 && errno == EINTR)
+            continue;
+          else
+          {
+            fail_all(r == 0 ? "tokyooo: server closed the connection" : std::string("tokyooo: recv: ") + std::strerror(errno));
+            return;
+          }
+        }
+        const char * p = received.empty() ? NULL : &received[0];
+        const char * end = p + received.size();
+        for (;;)
+        {
+          pending * front = NULL;
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (!inflight_.empty())
+              front = inflight_.front();
+          }
+          if (front == NULL || !front->parse(p, end))
+            break;
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+            inflight_.pop_front();
+          }
+          drained_.notify_one();
+          delete front;
+        }
+        received.erase(received.begin(), received.begin() + (p - (received.empty() ? NULL : &received[0])));
+      }
+      bool need_write = sent < sending.size();
+      if (!need_write)
+      {
+        // more may have been queued while we were busy, without waking us
+        boost::mutex::scoped_lock lock(mutex_);
+        need_write = !out_.empty();
+      }
+      if (need_write != want_write)
+      {
+        epoll_event ev = {};
+        ev.events = EPOLLIN | (need_write ? int(EPOLLOUT) : 0);
+        ev.data.fd = sock_;
+        ::epoll_ctl(epoll_, EPOLL_CTL_MOD, sock_, &ev);
+        want_write = need_write;
+      }
+    }
+    fail_all("tokyooo: connection closed");
+  }
+
+  void connect(const std::string & host, int port)
+  {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo * addrs = NULL;
+    int rc = ::getaddrinfo(host.c_str(), boost::lexical_cast<std::string>(port).c_str(), &hints, &addrs);
+    if (rc != 0)
+      err::go(std::string("tokyooo: getaddrinfo: ") + gai_strerror(rc));
+    for (addrinfo * a = addrs; a != NULL && sock_ == -1; a = a->ai_next)
+    {
+      sock_ = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (sock_ != -1 && ::connect(sock_, a->ai_addr, a->ai_addrlen) != 0)
+      {
+        ::close(sock_);
+        sock_ = -1;
+      }
+    }
+    ::freeaddrinfo(addrs);
+    if (sock_ == -1)
+      err::go("tokyooo: can't connect to " + host + ":" + boost::lexical_cast<std::string>(port));
+    int one = 1;
+    ::setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ::fcntl(sock_, F_SETFL, ::fcntl(sock_, F_GETFL) | O_NONBLOCK);
+  }
+
+  void close_fds()
+  {
+    if (sock_ != -1)
+      ::close(sock_);
+    if (wake_ != -1)
+      ::close(wake_);
+    if (epoll_ != -1)
+      ::close(epoll_);
+  }
+
+public:
+
+  // max_inflight caps how many requests can be waiting for replies; callers past it block.  0 for
+  // no cap
+  async_rdb(const std::string & host, int port, std::size_t max_inflight = 0)
+  : sock_(-1), wake_(-1), epoll_(-1), max_inflight_(max_inflight), wake_needed_(false), stopping_(false)
+  {
+    try
+    {
+      connect(host, port);
+      wake_ = ::eventfd(0, EFD_NONBLOCK);
+      epoll_ = ::epoll_create1(0);
+      if (wake_ == -1 || epoll_ == -1)
+        err::go(std::string("tokyooo: ") + std::strerror(errno));
+      epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.fd = sock_;
+      ::epoll_ctl(epoll_, EPOLL_CTL_ADD, sock_, &ev);
+      ev.data.fd = wake_;
+      ::epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &ev);
+      thread_ = boost::thread(boost::bind(&async_rdb::run, this));
+    }
+    catch (...)
+    {
+      close_fds();
+      throw;
+    }
+  }
+
+  // requests still in flight fail with "connection closed"
+  ~async_rdb()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+    }
+    boost::uint64_t one = 1;
+    ssize_t ignored = ::write(wake_, &one, sizeof(one));
+    (void) ignored;
+    thread_.join();
+    close_fds();
+  }
+
+  // resolves true once stored.  false means keep found the key already there.  nr mode doesn't
+  // wait for the server at all - its future is ready right away
+  template<class Key, class Value>
+  typename future<bool>::type put(const Key & key, const Value & value, put_mode_e put_mode = store, int width = 0)
+  {
+    command_e cmd;
+    switch (put_mode)
+    {
+    case store: cmd = cmd_put; break;
+    case keep: cmd = cmd_putkeep; break;
+    case cat: cmd = cmd_putcat; break;
+    case shl: cmd = cmd_putshl; break;
+    case nr: cmd = cmd_putnr; break;
+    default: err::go("expardon me?"); return typename future<bool>::type();
+    }
+    packed k(key), v(value);
+    status_reply * r = (cmd == cmd_putnr) ? NULL : new status_reply;
+    typename future<bool>::type ret_val;
+    if (r)
+      ret_val = r->promise.get_future();
+    else
+    {
+      boost::promise<bool> done;
+      done.set_value(true);
+      ret_val = done.get_future();
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    std::vector<char> & out = begin_request(lock, cmd);
+    put_int32(out, k.size());
+    put_int32(out, v.size());
+    if (cmd == cmd_putshl)
+      put_int32(out, width);
+    put_bytes(out, k.data(), k.size());
+    put_bytes(out, v.data(), v.size());
+    submit(r);
+    return ret_val;
+  }
+
+  // resolves to the value, or to nothing if there's no such record.  r.get<std::string>(key)
+  template<class Value, class Key>
+  typename future< boost::optional<Value> >::type get(const Key & key)
+  {
+    packed k(key);
+    get_reply<Value> * r = new get_reply<Value>;
+    typename future< boost::optional<Value> >::type ret_val = r->promise.get_future();
+    boost::mutex::scoped_lock lock(mutex_);
+    std::vector<char> & out = begin_request(lock, cmd_get);
+    put_int32(out, k.size());
+    put_bytes(out, k.data(), k.size());
+    submit(r);
+    return ret_val;
+  }
+
+  // resolves false if there was nothing to remove
+  template<class Key>
+  typename future<bool>::type out(const Key & key)
+  {
+    packed k(key);
+    status_reply * r = new status_reply;
+    typename future<bool>::type ret_val = r->promise.get_future();
+    boost::mutex::scoped_lock lock(mutex_);
+    std::vector<char> & out = begin_request(lock, cmd_out);
+    put_int32(out, k.size());
+    put_bytes(out, k.data(), k.size());
+    submit(r);
+    return ret_val;
+  }
+
+  // resolves to the new sum
+  template<class Key>
+  typename future<int>::type add(const Key & key, int value)
+  {
+    packed k(key);
+    addint_reply * r = new addint_reply;
+    typename future<int>::type ret_val = r->promise.get_future();
+    boost::mutex::scoped_lock lock(mutex_);
+    std::vector<char> & out = begin_request(lock, cmd_addint);
+    put_int32(out, k.size());
+    put_int32(out, value);
+    put_bytes(out, k.data(), k.size());
+    submit(r);
+    return ret_val;
+  }
+
+  // same as rdb::misc - "putlist", "getlist", "outlist" and friends
+  future<list>::type misc(const std::string & name, list & args, rdb::misc_options_e options = rdb::misc_default)
+  {
+    misc_reply * r = new misc_reply;
+    future<list>::type ret_val = r->promise.get_future();
+    boost::mutex::scoped_lock lock(mutex_);
+    std::vector<char> & out = begin_request(lock, cmd_misc);
+    put_int32(out, name.size());
+    put_int32(out, options);
+    put_int32(out, args.size());
+    put_bytes(out, name.data(), name.size());
+    for (int i = 0; i < static_cast<int>(args.size()); ++i)
+    {
+      int size = 0;
+      const void * p = tclistval(args.native(), i, &size);
+      put_int32(out, size);
+      put_bytes(out, p, size);
+    }
+    submit(r);
+    return ret_val;
+  }
+
+  // requests sent (or queued to send) that haven't been answered yet
+  std::size_t inflight()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return inflight_.size();
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_ASYNC_RDB_HPP__
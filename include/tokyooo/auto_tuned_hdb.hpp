@@ -0,0 +1,465 @@
+#ifndef __TOKYOOO_AUTO_TUNED_HDB_HPP__
+#define __TOKYOOO_AUTO_TUNED_HDB_HPP__
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <cstdio>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <tchdb.h>
+#include "util.hpp"
+#include "hdb.hpp"
+#include "store.hpp"
+
+namespace tokyooo {
+
+// a hash database that keeps its bucket array in proportion to what's in it.  the file is created
+// tuned for expected_records of about value_size bytes (see hdb::tuning_for), and a background
+// thread looks at the load factor every interval; past max_load it rebuilds the file with four
+// buckets a record, while calls carry on against the old one:
+//
+//   1. the file is copied to path.rebuild - writers wait for this, as for hdb::copy, readers don't
+//   2. the copy is optimized with the new tuning, with nobody waiting
+//   3. keys written since 1 are copied over again from the old file, in passes, until few are left
+//   4. everyone waits while the last few are copied, the copy is renamed over path, and calls go to
+//      it from then on
+//
+// 3 copies a key's value as it is when the pass gets to it, so it works for every kind of write,
+// transactions included, at the cost of keeping the keys written during a rebuild in memory.  a
+// rebuild that fails leaves the old file as it was and tries again next time round, a little later
+// each time; rebuilds() has what happened, when and how long each part took.  every call takes a
+// shared lock to keep out of the way of 4, so with many threads this is a little slower than a
+// mutexed hdb.  it's a Store (see store.hpp).
+class auto_tuned_hdb : public boost::noncopyable
+{
+public:
+
+  struct rebuild_report
+  {
+    boost::posix_time::ptime started;   // utc
+    boost::uint64_t usec;               // start to finish
+    boost::uint64_t copy_usec;          // writers waited this long...
+    boost::uint64_t switch_usec;        // ...and everyone this long
+    size_type records;                  // when it started
+    boost::int64_t old_bnum;
+    boost::int64_t new_bnum;
+    size_type replayed;                 // keys written during the rebuild, copied over again
+    std::string error;                  // empty if it worked
+  };
+
+private:
+
+  typedef boost::unordered_set<std::string> journal_t;
+
+  std::string path_;
+
+  hdb::open_options_e options_;       // as opened, less create and trunc, for reopening after a rebuild
+
+  std::size_t value_size_;
+
+  double max_load_;
+
+  boost::posix_time::time_duration interval_;
+
+  boost::shared_mutex switch_mutex_;  // shared by every call, held alone for step 4
+
+  boost::shared_ptr<hdb> hdb_;
+
+  boost::uint64_t generation_;        // bumped by vanish, so a rebuild that started before gives up
+
+  boost::mutex rebuild_mutex_;        // one rebuild at a time
+
+  boost::atomic<bool> journaling_;
+
+  boost::mutex journal_mutex_;
+
+  journal_t journal_;
+
+  boost::mutex mutex_;                // reports_, stop_
+
+  boost::condition_variable wake_;
+
+  std::vector<rebuild_report> reports_;
+
+  bool stop_;
+
+  boost::scoped_ptr<boost::thread> thread_;
+
+  static boost::uint64_t usec_since(const boost::posix_time::ptime & start)
+  {
+    return (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+  }
+
+  // called after the write, so a rebuild that starts in between has it in its copy
+  void touched(const packed & k)
+  {
+    if (!journaling_.load())
+      return;
+    std::string key(static_cast<const char *>(k.data()), k.size());
+    boost::mutex::scoped_lock lock(journal_mutex_);
+    journal_.insert(key);
+  }
+
+  void take_journal(journal_t & keys)
+  {
+    keys.clear();
+    boost::mutex::scoped_lock lock(journal_mutex_);
+    keys.swap(journal_);
+  }
+
+  // makes keys in to what they are in from
+  static void replay(hdb & from, hdb & to, const journal_t & keys)
+  {
+    std::string value;
+    for (journal_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      view k(it->data(), it->size());
+      if (from.get(k, value))
+        to.put(k, value);
+      else
+      {
+        result r = to.try_out(k);
+        (r.ok() || r.not_found()) || err::go(r);
+      }
+    }
+  }
+
+  rebuild_report rebuild_once()
+  {
+    boost::mutex::scoped_lock rebuilding(rebuild_mutex_);
+    rebuild_report r = rebuild_report();
+    r.started = boost::posix_time::microsec_clock::universal_time();
+    std::string tmp = path_ + ".rebuild";
+    // hdb_ only changes under rebuild_mutex_, so old stays put; generation_ doesn't
+    boost::shared_ptr<hdb> old = hdb_;
+    boost::uint64_t generation = 0;
+    {
+      boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+      generation = generation_;
+    }
+    r.records = old->size();
+    r.old_bnum = old->bucket_count();
+    journal_t keys;
+    take_journal(keys);
+    journaling_ = true;
+    try
+    {
+      boost::posix_time::ptime copy_start = boost::posix_time::microsec_clock::universal_time();
+      old->copy(tmp);
+      r.copy_usec = usec_since(copy_start);
+      boost::shared_ptr<hdb> fresh( new hdb(true) );
+      fresh->open(tmp, hdb::writer);
+      hdb::tuning t = hdb::tuning_for(r.records * 2, value_size_);
+      t.opts = hdb::tune_options_e(t.opts | tchdbopts(old->native())); // compression stays as it was
+      fresh->optimize(t);
+      r.new_bnum = fresh->bucket_count();
+      for (int pass = 0; pass < 16; ++pass)
+      {
+        take_journal(keys);
+        r.replayed += keys.size();
+        replay(*old, *fresh, keys);
+        if (keys.size() <= 1024)
+          break;
+      }
+      {
+        boost::unique_lock<boost::shared_mutex> lock(switch_mutex_);
+        boost::posix_time::ptime switch_start = boost::posix_time::microsec_clock::universal_time();
+        if (generation_ != generation)
+          err::go("tokyooo: auto_tuned_hdb was vanished during a rebuild");
+        take_journal(keys);
+        journaling_ = false;
+        r.replayed += keys.size();
+        replay(*old, *fresh, keys);
+        std::rename(tmp.c_str(), path_.c_str()) == 0
+          || err::go("tokyooo: auto_tuned_hdb couldn't rename " + tmp + " to " + path_);
+        // tchdb copies, and names its wal, by the path it was opened with, so it's reopened under
+        // the new name - or the next rebuild would copy a file that isn't there any more
+        fresh->close();
+        fresh->open(path_, options_);
+        hdb_ = fresh;
+        r.switch_usec = usec_since(switch_start);
+      }
+    }
+    catch (std::exception & e)
+    {
+      journaling_ = false;
+      take_journal(keys);
+      std::remove(tmp.c_str());
+      r.error = e.what();
+    }
+    // the old file is gone from the directory by now, and closes as the last of it goes
+    old.reset();
+    r.usec = usec_since(r.started);
+    boost::mutex::scoped_lock lock(mutex_);
+    reports_.push_back(r);
+    return r;
+  }
+
+  void run()
+  {
+    int failures = 0;
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!stop_)
+    {
+      wake_.timed_wait(lock, interval_ * (1 << failures));
+      if (stop_)
+        break;
+      lock.unlock();
+      if (load_factor() > max_load_)
+      {
+        if (rebuild_once().error.empty())
+          failures = 0;
+        else if (failures < 6)
+          ++failures;
+      }
+      lock.lock();
+    }
+  }
+
+  void stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    if (thread_)
+    {
+      thread_->join();
+      thread_.reset();
+    }
+  }
+
+public:
+
+  // tuning only happens when the file is created; an existing one is rebuilt on the first check if
+  // it's already past max_load.  a max_load of 0 leaves it to you to call rebuild()
+  auto_tuned_hdb( const std::string & path,
+                  boost::uint64_t expected_records,
+                  std::size_t value_size,
+                  hdb::open_options_e options = hdb::open_options_e(hdb::writer | hdb::create),
+                  double max_load = 2,
+                  const boost::posix_time::time_duration & interval = boost::posix_time::seconds(1) )
+  : path_(path), options_(hdb::open_options_e(options & ~(hdb::create | hdb::trunc))),
+    value_size_(value_size), max_load_(max_load), interval_(interval), hdb_(new hdb(true)), generation_(0), journaling_(false), stop_(false)
+  {
+    hdb_->tune(hdb::tuning_for(expected_records, value_size));
+    hdb_->open(path, options);
+    if (max_load_ > 0 && (options & hdb::writer))
+      thread_.reset( new boost::thread(&auto_tuned_hdb::run, this) );
+  }
+
+  // waits for a rebuild in progress to finish
+  ~auto_tuned_hdb()
+  {
+    stop();
+  }
+
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    result r = try_put(key, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->get(key, value);
+  }
+
+  template<class Key>
+  int get_into(const Key & key, void * buffer, int capacity)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->get_into(key, buffer, capacity);
+  }
+
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->get_view(key, value);
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->vsize(key);
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    packed k(key);
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    result ret_val = hdb_->try_put(view(k.data(), k.size()), value, put_mode);
+    touched(k);
+    return ret_val;
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    packed k(key);
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    result ret_val = hdb_->try_out(view(k.data(), k.size()));
+    touched(k);
+    return ret_val;
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->try_get(key, value);
+  }
+
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->try_get_view(key, value);
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->try_vsize(key, size);
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    packed k(key);
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    result ret_val = hdb_->try_add(view(k.data(), k.size()), value, sum);
+    touched(k);
+    return ret_val;
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    packed k(key);
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    result ret_val = hdb_->try_add(view(k.data(), k.size()), value, sum);
+    touched(k);
+    return ret_val;
+  }
+
+  // rebuilds now, on this thread, whatever the load factor - calls from other threads carry on as
+  // they would during a background one.  throws if it failed
+  rebuild_report rebuild()
+  {
+    rebuild_report ret_val = rebuild_once();
+    ret_val.error.empty() || err::go(ret_val.error);
+    return ret_val;
+  }
+
+  // every rebuild so far, oldest first, failed ones included
+  std::vector<rebuild_report> rebuilds()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return reports_;
+  }
+
+  void sync()
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    hdb_->sync();
+  }
+
+  // a rebuild in progress gives up
+  void vanish()
+  {
+    boost::unique_lock<boost::shared_mutex> lock(switch_mutex_);
+    ++generation_;
+    hdb_->vanish();
+  }
+
+  // stops the watching, waiting for a rebuild in progress to finish, and closes the file
+  void close()
+  {
+    stop();
+    boost::mutex::scoped_lock rebuilding(rebuild_mutex_);
+    boost::unique_lock<boost::shared_mutex> lock(switch_mutex_);
+    hdb_->close();
+  }
+
+  std::string path() const
+  {
+    return path_;
+  }
+
+  size_type size()
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->size();
+  }
+
+  size_type fsize()
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->fsize();
+  }
+
+  boost::int64_t bucket_count()
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->bucket_count();
+  }
+
+  double load_factor()
+  {
+    boost::shared_lock<boost::shared_mutex> lock(switch_mutex_);
+    return hdb_->load_factor();
+  }
+};
+
+BOOST_CONCEPT_ASSERT((Store<auto_tuned_hdb>));
+
+} // tokyooo
+
+#endif // __TOKYOOO_AUTO_TUNED_HDB_HPP__
@@ -0,0 +1,774 @@
+#ifndef __TOKYOOO_BDB_HPP__
+#define __TOKYOOO_BDB_HPP__
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <malloc.h>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <tcutil.h>
+#include <tcbdb.h>
+#include "util.hpp"
+#include "list.hpp"
+#include "stats.hpp"
+#include "store.hpp"
+#include "order.hpp"
+
+namespace tokyooo {
+
+// the options, outside the template so every basic_bdb shares them
+struct bdb_base
+{
+  enum tune_options_e
+  {
+    tune_default = 0,
+    large = BDBTLARGE,
+    deflate = BDBTDEFLATE,
+    bzip = BDBTBZIP,
+    tcbs = BDBTTCBS
+  };
+  enum open_options_e
+  {
+    open_default = 0,
+    writer = BDBOWRITER,
+    reader = BDBOREADER,
+    create = BDBOCREAT,
+    trunc = BDBOTRUNC,
+    synchronize = BDBOTSYNC,
+    no_lock = BDBONOLCK,
+    lock_nb = BDBOLCKNB
+  };
+};
+
+// the b+ tree database: hdb's api, plus keys kept in Order so you can walk a range of them, and
+// more than one record per key if you put with duplicate
+template<class Order = lexical_order, class Stats = no_stats>
+class basic_bdb : public bdb_base, public boost::noncopyable
+{
+private:
+
+  TCBDB * bdb_;
+
+  Stats stats_;
+
+  result outcome(bool ok, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(bdb_);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+  static std::string bytes(const packed & p)
+  {
+    return std::string(static_cast<const char *>(p.data()), p.size());
+  }
+
+  void init(bool mutexed, int lmemb, int nmemb, boost::int64_t bnum, char apow, char fpow, tune_options_e opts,
+            int lcnum, int ncnum, boost::int64_t xmsize)
+  {
+    tcbdbsetcmpfunc(bdb_, Order::function(), NULL) || err::go(bdb_);
+    if (mutexed)
+      set_mutexed();
+    tune(lmemb, nmemb, bnum, apow, fpow, opts);
+    set_cache(lcnum, ncnum);
+    set_extra_mm(xmsize);
+  }
+
+public:
+
+  basic_bdb( bool mutexed = false,
+             int lmemb = 128,
+             int nmemb = 256,
+             boost::int64_t bnum = 32749,
+             char apow = 8,
+             char fpow = 10,
+             tune_options_e opts = tune_default,
+             int lcnum = 0,
+             int ncnum = 0,
+             boost::int64_t xmsize = 0 )
+  : bdb_(tcbdbnew())
+  {
+    init(mutexed, lmemb, nmemb, bnum, apow, fpow, opts, lcnum, ncnum, xmsize);
+  }
+
+  basic_bdb( const std::string & path,
+             open_options_e options = open_default,
+             bool mutexed = false,
+             int lmemb = 128,
+             int nmemb = 256,
+             boost::int64_t bnum = 32749,
+             char apow = 8,
+             char fpow = 10,
+             tune_options_e opts = tune_default,
+             int lcnum = 0,
+             int ncnum = 0,
+             boost::int64_t xmsize = 0 )
+  : bdb_(tcbdbnew())
+  {
+    init(mutexed, lmemb, nmemb, bnum, apow, fpow, opts, lcnum, ncnum, xmsize);
+    open(path, options);
+  }
+
+  ~basic_bdb()
+  {
+    tcbdbclose(bdb_);
+    tcbdbdel(bdb_);
+  }
+
+  void set_mutexed()
+  {
+    tcbdbsetmutex(bdb_) || err::go(bdb_);
+  }
+
+  // lmemb and nmemb are how many records go in a leaf page and how many keys in an inner one
+  void tune( int lmemb, int nmemb, boost::int64_t bnum, char apow, char fpow, tune_options_e opts )
+  {
+    tcbdbtune(bdb_, lmemb, nmemb, bnum, apow, fpow, opts) || err::go(bdb_);
+  }
+
+  // how many leaf and inner pages to keep in memory.  0 is tcbdb's default
+  void set_cache(int lcnum, int ncnum)
+  {
+    tcbdbsetcache(bdb_, lcnum, ncnum) || err::go(bdb_);
+  }
+
+  void set_extra_mm(boost::int64_t xmsize)
+  {
+    tcbdbsetxmsiz(bdb_, xmsize) || err::go(bdb_);
+  }
+
+  void open(const std::string & path, open_options_e options = open_default)
+  {
+    typename Stats::timer t(stats_, op_open);
+    tcbdbopen(bdb_, path.c_str(), options) || err::go(bdb_);
+  }
+
+  void close()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcbdbclose(bdb_) || err::go(bdb_);
+  }
+
+  // keys and values of any type with a codec<> - see codec.hpp.  duplicate adds a record after any
+  // already under key
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    result r = try_put(key, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  // every value in [begin, end) as another record under key, in one call
+  template<class Key, class InputIterator>
+  void put_dups(const Key & key, InputIterator begin, InputIterator end)
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key);
+    list values(begin, end);
+    t.add_bytes(k.size());
+    tcbdbputdup3(bdb_, k.data(), k.size(), values.native()) || err::go(bdb_);
+  }
+
+  // the first record under key
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  // every record under key
+  template<class Key>
+  void out_all(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    tcbdbout3(bdb_, k.data(), k.size()) || err::go(bdb_);
+  }
+
+  // the first record under key
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    result r = try_get(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  // every record under key, in the order they were put
+  template<class Key, class Value>
+  bool get_all(const Key & key, std::vector<Value> & values)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    list tmp( tcbdbget4(bdb_, k.data(), k.size()) );
+    if (!tmp.native())
+    {
+      (tcbdbecode(bdb_) == TCENOREC) || err::go(bdb_);
+      return false;
+    }
+    values = tmp.template to_vector<Value>();
+    return true;
+  }
+
+  // points value at a copy in this thread's scratch buffer - good until this thread's next get_view
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    result r = try_get_view(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    int ret_val = -1;
+    result r = try_vsize(key, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  // how many records are under key
+  template<class Key>
+  int count(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    packed k(key);
+    t.add_bytes(k.size());
+    int ret_val = tcbdbvnum(bdb_, k.data(), k.size());
+    (ret_val != 0 || tcbdbecode(bdb_) == TCENOREC) || err::go(bdb_);
+    return ret_val;
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  // the same calls without the exceptions, as in hdb
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key), v(value);
+    t.add_bytes(k.size() + v.size());
+    bool ok = false;
+    switch (put_mode)
+    {
+    case store: ok = tcbdbput(bdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case keep: ok = tcbdbputkeep(bdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case cat: ok = tcbdbputcat(bdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case duplicate: ok = tcbdbputdup(bdb_, k.data(), k.size(), v.data(), v.size()); break;
+    default: err::go("expardon me?"); break;
+    }
+    return outcome(ok, t);
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tcbdbout(bdb_, k.data(), k.size()), t);
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    int size = 0;
+    void * p = tcbdbget( bdb_, k.data(), k.size(), &size );
+    if (p == NULL)
+      return outcome(false, t);
+    t.add_bytes(k.size() + size);
+    try
+    {
+      unpack(value, p, size);
+    }
+    catch (...)
+    {
+      std::free(p);
+      throw;
+    }
+    std::free(p);
+    return result();
+  }
+
+  // tcbdbget3 would point into the leaf page, but that's only safe until the lock is let go, which
+  // is before it returns - so this copies, as rdb::get_view does.  the iterators are the zero copy way
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    int size = 0;
+    void * p = tcbdbget( bdb_, k.data(), k.size(), &size );
+    if (p == NULL)
+      return outcome(false, t);
+    t.add_bytes(k.size() + size);
+    std::vector<char> & buffer = thread_buffer();
+    if (size > static_cast<int>(buffer.size()))
+      buffer.resize(size);
+    std::memcpy(&buffer[0], p, size);
+    std::free(p);
+    value = view(&buffer[0], size);
+    return result();
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcbdbvsiz( bdb_, k.data(), k.size() );
+    if (got == -1)
+      return outcome(false, t);
+    size = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcbdbaddint(bdb_, k.data(), k.size(), value);
+    if (got == std::numeric_limits<int>::min())
+      return outcome(false, t);
+    sum = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    double got = tcbdbadddouble(bdb_, k.data(), k.size(), value);
+    if (std::isnan(got))
+      return outcome(false, t);
+    sum = got;
+    return result();
+  }
+
+  // a walk forward through the tree from a starting key, until a key reaches the upper bound or
+  // stops matching the prefix.  every walk has its own tcbdb cursor, so any number can be going at
+  // once, but like hdb::iterator it's single pass and copies share a position.  the records are
+  // views straight into the leaf pages (tcbdbcurkey3/tcbdbcurval3), so nothing is allocated per
+  // record, and they go stale on the next increment or the next write to the database.
+  class iterator
+  {
+  private:
+
+    struct state : public boost::noncopyable
+    {
+      TCBDB * db;
+      BDBCUR * cur;
+      Stats & stats;
+      std::string to;
+      bool bounded;
+      std::string prefix;
+      tokyooo::record rec;
+
+      state(TCBDB * db, Stats & stats) : db(db), cur(tcbdbcurnew(db)), stats(stats), bounded(false) {}
+
+      ~state()
+      {
+        tcbdbcurdel(cur);
+      }
+    };
+
+    boost::shared_ptr<state> state_; // empty at the end
+
+    // picks up the record the cursor just moved to, or ends the walk
+    void settle(bool moved)
+    {
+      state & s = *state_;
+      int ksize = 0, vsize = 0;
+      const void * k = moved ? tcbdbcurkey3(s.cur, &ksize) : NULL;
+      const void * v = k ? tcbdbcurval3(s.cur, &vsize) : NULL;
+      if (v == NULL)
+      {
+        (tcbdbecode(s.db) == TCENOREC) || err::go(s.db);
+        state_.reset();
+        return;
+      }
+      if ((s.bounded && Order::function()(static_cast<const char *>(k), ksize, s.to.data(), s.to.size(), NULL) >= 0) ||
+          (!s.prefix.empty() && (ksize < static_cast<int>(s.prefix.size()) ||
+                                 std::memcmp(k, s.prefix.data(), s.prefix.size()) != 0)))
+      {
+        state_.reset();
+        return;
+      }
+      s.rec.key = view(k, ksize);
+      s.rec.value = view(v, vsize);
+    }
+
+  public:
+
+    typedef std::input_iterator_tag iterator_category;
+    typedef tokyooo::record value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const tokyooo::record * pointer;
+    typedef const tokyooo::record & reference;
+
+    iterator() {}
+
+    // from the first key not below from (the first key, if from.data is NULL), up to but not
+    // including to (no bound if to.data is NULL), only while keys start with prefix
+    iterator(TCBDB * db, Stats & stats, view from, view to, view prefix)
+    : state_(new state(db, stats))
+    {
+      typename Stats::timer t(stats, op_iterate);
+      if (to.data)
+      {
+        state_->to.assign(to.data, to.size);
+        state_->bounded = true;
+      }
+      state_->prefix.assign(prefix.data ? prefix.data : "", prefix.size);
+      settle(from.data ? tcbdbcurjump(state_->cur, from.data, from.size) : tcbdbcurfirst(state_->cur));
+    }
+
+    reference operator* () const { return state_->rec; }
+
+    pointer operator-> () const { return &state_->rec; }
+
+    iterator & operator++ ()
+    {
+      typename Stats::timer t(state_->stats, op_iterate);
+      t.add_bytes(state_->rec.key.size + state_->rec.value.size);
+      settle(tcbdbcurnext(state_->cur));
+      return *this;
+    }
+
+    bool operator== (const iterator & other) const { return state_ == other.state_; }
+
+    bool operator!= (const iterator & other) const { return state_ != other.state_; }
+  };
+
+  // what range() and prefix() hand back: for (const record & r : b.range(lo, hi)) ...
+  struct record_range
+  {
+    TCBDB * db;
+    Stats * stats;
+    std::string from;
+    std::string to;
+    std::string prefix;
+    bool has_from;
+    bool has_to;
+
+    iterator begin() const
+    {
+      return iterator(db, *stats, has_from ? view(from.data(), from.size()) : view(),
+                      has_to ? view(to.data(), to.size()) : view(), view(prefix.data(), prefix.size()));
+    }
+
+    iterator end() const { return iterator(); }
+  };
+
+  iterator begin()
+  {
+    return iterator(bdb_, stats_, view(), view(), view());
+  }
+
+  iterator end()
+  {
+    return iterator();
+  }
+
+  // keys from lo up to but not including hi, in Order
+  template<class Key>
+  record_range range(const Key & lo, const Key & hi)
+  {
+    packed l(lo), h(hi);
+    record_range ret_val = { bdb_, &stats_, bytes(l), bytes(h), std::string(), true, true };
+    return ret_val;
+  }
+
+  // keys from lo to the end
+  template<class Key>
+  record_range range_from(const Key & lo)
+  {
+    packed l(lo);
+    record_range ret_val = { bdb_, &stats_, bytes(l), std::string(), std::string(), true, false };
+    return ret_val;
+  }
+
+  // keys starting with the bytes of p.  only makes sense in lexical_order, where they're together
+  template<class Prefix>
+  record_range prefix(const Prefix & p)
+  {
+    packed b(p);
+    record_range ret_val = { bdb_, &stats_, bytes(b), std::string(), bytes(b), true, false };
+    return ret_val;
+  }
+
+  // a tcbdb cursor you steer yourself - both ways, and it can change the record it's on.  moves
+  // return false when they run off either end.  key() and value() are views into the leaf page,
+  // good until the cursor moves or the database is written to
+  class cursor : public boost::noncopyable
+  {
+  private:
+
+    TCBDB * db_;
+
+    BDBCUR * cur_;
+
+    Stats & stats_;
+
+    bool moved(bool ok)
+    {
+      if (!ok)
+        (tcbdbecode(db_) == TCENOREC) || err::go(db_);
+      return ok;
+    }
+
+  public:
+
+    enum put_e
+    {
+      current = BDBCPCURRENT,   // replace the value
+      before = BDBCPBEFORE,     // another record under the same key, before this one
+      after = BDBCPAFTER        // and after it
+    };
+
+    explicit cursor(basic_bdb & b)
+    : db_(b.native()), cur_(tcbdbcurnew(db_)), stats_(b.stats()) {}
+
+    ~cursor()
+    {
+      tcbdbcurdel(cur_);
+    }
+
+    bool first()
+    {
+      typename Stats::timer t(stats_, op_iterate);
+      return moved(tcbdbcurfirst(cur_));
+    }
+
+    bool last()
+    {
+      typename Stats::timer t(stats_, op_iterate);
+      return moved(tcbdbcurlast(cur_));
+    }
+
+    // to the first record whose key isn't below key
+    template<class Key>
+    bool jump(const Key & key)
+    {
+      typename Stats::timer t(stats_, op_iterate);
+      packed k(key);
+      return moved(tcbdbcurjump(cur_, k.data(), k.size()));
+    }
+
+    // to the last record whose key isn't above key
+    template<class Key>
+    bool jump_back(const Key & key)
+    {
+      typename Stats::timer t(stats_, op_iterate);
+      packed k(key);
+      return moved(tcbdbcurjumpback(cur_, k.data(), k.size()));
+    }
+
+    bool next()
+    {
+      typename Stats::timer t(stats_, op_iterate);
+      return moved(tcbdbcurnext(cur_));
+    }
+
+    bool prev()
+    {
+      typename Stats::timer t(stats_, op_iterate);
+      return moved(tcbdbcurprev(cur_));
+    }
+
+    view key()
+    {
+      int size = 0;
+      const void * p = tcbdbcurkey3(cur_, &size);
+      p || err::go(db_);
+      return view(p, size);
+    }
+
+    view value()
+    {
+      int size = 0;
+      const void * p = tcbdbcurval3(cur_, &size);
+      p || err::go(db_);
+      return view(p, size);
+    }
+
+    template<class Key>
+    void get_key(Key & key)
+    {
+      view k = this->key();
+      unpack(key, k.data, k.size);
+    }
+
+    template<class Value>
+    void get_value(Value & value)
+    {
+      view v = this->value();
+      unpack(value, v.data, v.size);
+    }
+
+    template<class Value>
+    void put(const Value & value, put_e mode = current)
+    {
+      typename Stats::timer t(stats_, op_put);
+      packed v(value);
+      t.add_bytes(v.size());
+      tcbdbcurput(cur_, v.data(), v.size(), mode) || err::go(db_);
+    }
+
+    // removes the record and moves on to the next one
+    void out()
+    {
+      typename Stats::timer t(stats_, op_out);
+      tcbdbcurout(cur_) || err::go(db_);
+    }
+  };
+
+  // everything done through the bdb between here and commit() happens at once or not at all.  if
+  // commit() isn't reached - an exception on the way out, say - it's all rolled back.  tcbdb runs
+  // one transaction at a time, so others wait here for this one to finish
+  class transaction : public boost::noncopyable
+  {
+  private:
+
+    basic_bdb & bdb_;
+
+    bool open_;
+
+  public:
+
+    explicit transaction(basic_bdb & b)
+    : bdb_(b), open_(false)
+    {
+      tcbdbtranbegin(bdb_.native()) || err::go(bdb_.native());
+      open_ = true;
+    }
+
+    ~transaction()
+    {
+      if (open_)
+        tcbdbtranabort(bdb_.native());
+    }
+
+    void commit()
+    {
+      typename Stats::timer t(bdb_.stats(), op_misc);
+      open_ = false;
+      tcbdbtrancommit(bdb_.native()) || err::go(bdb_.native());
+    }
+
+    void abort()
+    {
+      open_ = false;
+      tcbdbtranabort(bdb_.native()) || err::go(bdb_.native());
+    }
+  };
+
+  void sync()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcbdbsync(bdb_) || err::go(bdb_);
+  }
+
+  void optimize( int lmemb, int nmemb, boost::int64_t bnum, char apow, char fpow, tune_options_e opts )
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcbdboptimize(bdb_, lmemb, nmemb, bnum, apow, fpow, opts) || err::go(bdb_);
+  }
+
+  void vanish()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcbdbvanish(bdb_) || err::go(bdb_);
+  }
+
+  void copy(const std::string & path)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcbdbcopy(bdb_, path.c_str()) || err::go(bdb_);
+  }
+
+  std::string path()
+  {
+    return std::string( tcbdbpath(bdb_) );
+  }
+
+  size_type size()
+  {
+    return tcbdbrnum(bdb_);
+  }
+
+  size_type fsize()
+  {
+    return tcbdbfsiz(bdb_);
+  }
+
+  TCBDB * native()
+  {
+    return bdb_;
+  }
+
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+};
+
+template<class Order, class Stats>
+struct supports_ordered_scan< basic_bdb<Order, Stats> > : boost::true_type {};
+
+template<class Order, class Stats>
+struct supports_transactions< basic_bdb<Order, Stats> > : boost::true_type {};
+
+typedef basic_bdb<> bdb;
+
+BOOST_CONCEPT_ASSERT((Store<bdb>));
+
+} // tokyooo
+
+#endif // __TOKYOOO_BDB_HPP__
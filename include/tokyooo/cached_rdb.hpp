@@ -0,0 +1,15 @@
+#ifndef __TOKYOOO_CACHED_RDB_HPP__
+#define __TOKYOOO_CACHED_RDB_HPP__
+
+#include "rdb.hpp"
+#include "cached_store.hpp"
+
+namespace tokyooo {
+
+// the read-through cache in front of a tyrant server.  tcrdb locks around each call, so the rdb
+// can be shared with the rest of the process
+typedef cached_store<rdb> cached_rdb;
+
+} // tokyooo
+
+#endif // __TOKYOOO_CACHED_RDB_HPP__
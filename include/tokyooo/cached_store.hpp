@@ -0,0 +1,437 @@
+#ifndef __TOKYOOO_CACHED_STORE_HPP__
+#define __TOKYOOO_CACHED_STORE_HPP__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <tcutil.h>
+#include "util.hpp"
+#include "map.hpp"
+#include "store.hpp"
+
+namespace tokyooo {
+
+// a read-through cache in front of any Store (see store.hpp).  get, and tbl_get if the Store has
+// tables, are answered from memory when they can be, and go to the Store and remember the answer
+// when they can't.  put, out, add and the tbl_ writes go straight through and drop whatever was
+// cached for that key, so this process never reads back something older than its own writes -
+// writes from other clients of a shared Store show up when the entry expires or gets evicted.
+//
+// the cache is split into stripes, each a tokyooo::map kept in lru order (tcmapmove on a hit,
+// tcmapcutfront to evict) behind its own lock.  max_entries and max_bytes (by map::msize, so
+// overhead included) are for the whole cache, split evenly between the stripes; 0 means no limit.
+// ttl is in seconds, 0 for never.  the Store is called from whatever thread misses, so it has to
+// be safe for that - an rdb is, an hdb has to be mutexed.
+template<class Store>
+class cached_store : public boost::noncopyable
+{
+private:
+
+  BOOST_CONCEPT_ASSERT((tokyooo::Store<Store>));
+
+public:
+
+  struct stats
+  {
+    boost::uint64_t hits;
+    boost::uint64_t misses;
+    boost::uint64_t evictions;      // pushed out to make room
+    boost::uint64_t expirations;    // found past their ttl
+    boost::uint64_t invalidations;  // dropped by a write through this cache
+    size_type entries;
+    size_type bytes;
+  };
+
+private:
+
+  // cached values are the expiry time followed by the value (or tcmapdump of the row).  keys are
+  // a tag followed by the key's encoding, so a key's value and row don't collide
+  enum tag_e
+  {
+    value_tag = 'v',
+    row_tag = 'r'
+  };
+
+  struct stripe
+  {
+    boost::mutex mutex;
+    map lru;                        // oldest first
+    boost::uint64_t generation;     // bumped by every invalidation, so a fill can tell it's stale
+    stats counts;
+  };
+
+  Store & store_;
+
+  std::size_t stripe_count_;
+
+  boost::scoped_array<stripe> stripes_;
+
+  size_type max_entries_;           // per stripe
+
+  size_type max_bytes_;             // per stripe
+
+  double ttl_;
+
+  static boost::int64_t now()
+  {
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+  }
+
+  static std::string cache_key(tag_e tag, const packed & k)
+  {
+    std::string ret_val(1, static_cast<char>(tag));
+    ret_val.append(static_cast<const char *>(k.data()), k.size());
+    return ret_val;
+  }
+
+  // already encoded, so the Store calls pass the bytes through as they are
+  static view bytes(const packed & k)
+  {
+    return view(k.data(), k.size());
+  }
+
+  stripe & stripe_of(const packed & k)
+  {
+    return stripes_[hash(k.data(), k.size()) % stripe_count_];
+  }
+
+  // copies the cached bytes for key into the thread's buffer.  false if they're not there or have
+  // expired
+  bool lookup(stripe & s, const std::string & key, view & out)
+  {
+    boost::mutex::scoped_lock lock(s.mutex);
+    int size = 0;
+    const char * p = static_cast<const char *>(tcmapget(s.lru.native(), key.data(), key.size(), &size));
+    if (p == NULL)
+    {
+      ++s.counts.misses;
+      return false;
+    }
+    boost::int64_t expires = 0;
+    std::memcpy(&expires, p, sizeof(expires));
+    if (expires != 0 && expires < now())
+    {
+      tcmapout(s.lru.native(), key.data(), key.size());
+      ++s.counts.expirations;
+      ++s.counts.misses;
+      return false;
+    }
+    std::vector<char> & buffer = thread_buffer();
+    int value_size = size - sizeof(expires);
+    if (value_size > static_cast<int>(buffer.size()))
+      buffer.resize(value_size);
+    std::memcpy(&buffer[0], p + sizeof(expires), value_size);
+    out = view(&buffer[0], value_size);
+    tcmapmove(s.lru.native(), key.data(), key.size(), false);
+    ++s.counts.hits;
+    return true;
+  }
+
+  // caches value for key, unless the key was invalidated since generation was read
+  void fill(stripe & s, boost::uint64_t generation, const std::string & key, const void * value, int size,
+            double ttl)
+  {
+    if (ttl < 0)
+      ttl = ttl_;
+    boost::int64_t expires = ttl > 0 ? now() + static_cast<boost::int64_t>(ttl * 1000000) : 0;
+    std::string entry(reinterpret_cast<const char *>(&expires), sizeof(expires));
+    entry.append(static_cast<const char *>(value), size);
+    boost::mutex::scoped_lock lock(s.mutex);
+    if (s.generation != generation)
+      return;
+    tcmapput(s.lru.native(), key.data(), key.size(), entry.data(), entry.size());
+    tcmapmove(s.lru.native(), key.data(), key.size(), false);
+    while ( s.lru.size() > 1 &&
+            ( (max_entries_ && s.lru.size() > max_entries_) || (max_bytes_ && s.lru.msize() > max_bytes_) ) )
+    {
+      s.lru.cutfront(1);
+      ++s.counts.evictions;
+    }
+  }
+
+  boost::uint64_t generation(stripe & s)
+  {
+    boost::mutex::scoped_lock lock(s.mutex);
+    return s.generation;
+  }
+
+  void drop(const packed & k)
+  {
+    stripe & s = stripe_of(k);
+    std::string value_key = cache_key(value_tag, k), row_key = cache_key(row_tag, k);
+    boost::mutex::scoped_lock lock(s.mutex);
+    ++s.generation;
+    s.counts.invalidations += tcmapout(s.lru.native(), value_key.data(), value_key.size());
+    s.counts.invalidations += tcmapout(s.lru.native(), row_key.data(), row_key.size());
+  }
+
+public:
+
+  cached_store( Store & s,
+                size_type max_entries,
+                size_type max_bytes = 0,
+                double ttl = 0,
+                std::size_t stripes = 16 )
+  : store_(s), stripe_count_(stripes ? stripes : 1), stripes_(new stripe[stripe_count_]),
+    max_entries_(max_entries ? std::max<size_type>(max_entries / stripe_count_, 1) : 0),
+    max_bytes_(max_bytes ? std::max<size_type>(max_bytes / stripe_count_, 1) : 0), ttl_(ttl)
+  {
+    stats zero = {};
+    for (std::size_t i = 0; i < stripe_count_; ++i)
+    {
+      stripes_[i].generation = 0;
+      stripes_[i].counts = zero;
+    }
+  }
+
+  // ttl < 0 uses the cache's own
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value, double ttl = -1)
+  {
+    result r = try_get(key, value, ttl);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  // hit or miss, the bytes end up in the thread's buffer
+  template<class Key>
+  bool get_view(const Key & key, view & value, double ttl = -1)
+  {
+    result r = try_get_view(key, value, ttl);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value, double ttl = -1)
+  {
+    view v;
+    result r = try_get_view(key, v, ttl);
+    if (r.ok())
+      unpack(value, v.data, v.size);
+    return r;
+  }
+
+  template<class Key>
+  result try_get_view(const Key & key, view & value, double ttl = -1)
+  {
+    packed k(key);
+    stripe & s = stripe_of(k);
+    std::string ck = cache_key(value_tag, k);
+    if (lookup(s, ck, value))
+      return result();
+    boost::uint64_t g = generation(s);
+    result r = store_.try_get_view(bytes(k), value);
+    if (r.ok())
+      fill(s, g, ck, value.data, value.size, ttl);
+    return r;
+  }
+
+  template<class Key>
+  bool tbl_get(const Key & key, map & m, double ttl = -1)
+  {
+    BOOST_STATIC_ASSERT(supports_tables<Store>::value);
+    packed k(key);
+    stripe & s = stripe_of(k);
+    std::string ck = cache_key(row_tag, k);
+    view cached;
+    if (lookup(s, ck, cached))
+    {
+      map tmp( tcmapload(cached.data, cached.size) );
+      m.swap(tmp);
+      return true;
+    }
+    boost::uint64_t g = generation(s);
+    map row;
+    if (!store_.tbl_get(bytes(k), row))
+      return false;
+    int size = 0;
+    void * p = tcmapdump(row.native(), &size);
+    fill(s, g, ck, p, size, ttl);
+    std::free(p);
+    m.swap(row);
+    return true;
+  }
+
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    packed k(key);
+    store_.put(bytes(k), value, put_mode);
+    drop(k);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    packed k(key);
+    store_.out(bytes(k));
+    drop(k);
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    packed k(key);
+    int ret_val = store_.add(bytes(k), value);
+    drop(k);
+    return ret_val;
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    packed k(key);
+    double ret_val = store_.add(bytes(k), value);
+    drop(k);
+    return ret_val;
+  }
+
+  // vsize isn't cached: it's the Store's answer every time
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    packed k(key);
+    return store_.vsize(bytes(k));
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    packed k(key);
+    result ret_val = store_.try_put(bytes(k), value, put_mode);
+    drop(k);
+    return ret_val;
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    packed k(key);
+    result ret_val = store_.try_out(bytes(k));
+    drop(k);
+    return ret_val;
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    packed k(key);
+    return store_.try_vsize(bytes(k), size);
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    packed k(key);
+    result ret_val = store_.try_add(bytes(k), value, sum);
+    drop(k);
+    return ret_val;
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    packed k(key);
+    result ret_val = store_.try_add(bytes(k), value, sum);
+    drop(k);
+    return ret_val;
+  }
+
+  template<class Key>
+  void tbl_put( const Key & key, map & row, put_mode_e mode = store )
+  {
+    BOOST_STATIC_ASSERT(supports_tables<Store>::value);
+    packed k(key);
+    store_.tbl_put(bytes(k), row, mode);
+    drop(k);
+  }
+
+  template<class Key>
+  void tbl_out(const Key & key)
+  {
+    BOOST_STATIC_ASSERT(supports_tables<Store>::value);
+    packed k(key);
+    store_.tbl_out(bytes(k));
+    drop(k);
+  }
+
+  // drops key from the cache without touching the Store, for when you know it changed elsewhere
+  template<class Key>
+  void invalidate(const Key & key)
+  {
+    packed k(key);
+    drop(k);
+  }
+
+  void clear()
+  {
+    for (std::size_t i = 0; i < stripe_count_; ++i)
+    {
+      boost::mutex::scoped_lock lock(stripes_[i].mutex);
+      ++stripes_[i].generation;
+      stripes_[i].lru.clear();
+    }
+  }
+
+  void sync()
+  {
+    store_.sync();
+  }
+
+  void vanish()
+  {
+    store_.vanish();
+    clear();
+  }
+
+  size_type size()
+  {
+    return store_.size();
+  }
+
+  stats statistics()
+  {
+    stats ret_val = {};
+    for (std::size_t i = 0; i < stripe_count_; ++i)
+    {
+      boost::mutex::scoped_lock lock(stripes_[i].mutex);
+      const stats & c = stripes_[i].counts;
+      ret_val.hits += c.hits;
+      ret_val.misses += c.misses;
+      ret_val.evictions += c.evictions;
+      ret_val.expirations += c.expirations;
+      ret_val.invalidations += c.invalidations;
+      ret_val.entries += stripes_[i].lru.size();
+      ret_val.bytes += stripes_[i].lru.msize();
+    }
+    return ret_val;
+  }
+
+  Store & backend()
+  {
+    return store_;
+  }
+};
+
+template<class Store>
+struct supports_tables< cached_store<Store> > : supports_tables<Store> {};
+
+} // tokyooo
+
+#endif // __TOKYOOO_CACHED_STORE_HPP__
@@ -0,0 +1,451 @@
+#ifndef __TOKYOOO_CODEC_HPP__
+#define __TOKYOOO_CODEC_HPP__
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_pod.hpp>
+#include <boost/type_traits/is_pointer.hpp>
+#include <boost/type_traits/is_array.hpp>
+#include <boost/type_traits/is_signed.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/preprocessor/seq/for_each.hpp>
+
+namespace tokyooo {
+
+// how keys and values become bytes and back again.  codec<T> is picked at compile time and has:
+//
+//   direct              true if the object's own bytes are its encoding - data(v) points at them
+//                       and nothing gets copied on the way into the database
+//   size(v)             how many bytes encode() will write
+//   encode(v, out)      write v at out, return one past the end
+//   decode(v, p, size)  read v back out of exactly size bytes, false if they don't make a T
+//
+// a record knows its own length, so at the top level strings and vectors are just their bytes.
+// fields of a registered struct go through field_size/encode_field/decode_field instead, where
+// anything variable-length carries a varint length in front.
+//
+// no codec for your type?  if it's safe to memcpy, specialize is_bitwise for it.  otherwise list its
+// fields with TOKYOOO_CODEC at the bottom of this file.
+template<class T, class Enable = void>
+struct codec;
+
+// types whose object representation is the encoding.  pointers and arrays are pods too but mean
+// something else here, so they're left to their own codecs
+template<class T>
+struct is_bitwise
+: boost::integral_constant<bool, boost::is_pod<T>::value && !boost::is_pointer<T>::value && !boost::is_array<T>::value>
+{};
+
+namespace detail {
+
+inline int varint_size(boost::uint64_t n)
+{
+  int size = 1;
+  for (; n >= 0x80; n >>= 7)
+    ++size;
+  return size;
+}
+
+inline char * varint_encode(boost::uint64_t n, char * out)
+{
+  for (; n >= 0x80; n >>= 7)
+    *out++ = static_cast<char>(n | 0x80);
+  *out++ = static_cast<char>(n);
+  return out;
+}
+
+inline const char * varint_decode(boost::uint64_t & n, const char * p, const char * end)
+{
+  n = 0;
+  for (int shift = 0; p != end && shift < 64; shift += 7)
+  {
+    unsigned char c = *p++;
+    n |= static_cast<boost::uint64_t>(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return p;
+  }
+  return NULL;
+}
+
+template<class T, bool Signed = boost::is_signed<T>::value>
+struct zigzag
+{
+  static boost::uint64_t to(T v) { return static_cast<boost::uint64_t>(v); }
+  static T from(boost::uint64_t n) { return static_cast<T>(n); }
+};
+
+template<class T>
+struct zigzag<T, true>
+{
+  static boost::uint64_t to(T v)
+  {
+    boost::int64_t n = v;
+    return (static_cast<boost::uint64_t>(n) << 1) ^ static_cast<boost::uint64_t>(n >> 63);
+  }
+  static T from(boost::uint64_t n) { return static_cast<T>(static_cast<boost::int64_t>((n >> 1) ^ (~(n & 1) + 1))); }
+};
+
+} // detail
+
+// length-prefixed field encoding, for codecs that only know how to do the top level
+template<class T, class Codec>
+struct codec_base
+{
+  static const bool direct = false;
+
+  static const void * data(const T &) { return NULL; }
+
+  static int field_size(const T & v)
+  {
+    int size = Codec::size(v);
+    return detail::varint_size(size) + size;
+  }
+
+  static char * encode_field(const T & v, char * out)
+  {
+    return Codec::encode(v, detail::varint_encode(Codec::size(v), out));
+  }
+
+  static const char * decode_field(T & v, const char * p, const char * end)
+  {
+    boost::uint64_t size = 0;
+    p = detail::varint_decode(size, p, end);
+    if (p == NULL || size > static_cast<boost::uint64_t>(end - p) || !Codec::decode(v, p, static_cast<int>(size)))
+      return NULL;
+    return p + size;
+  }
+};
+
+template<class T>
+struct codec<T, typename boost::enable_if< is_bitwise<T> >::type>
+{
+  static const bool direct = true;
+
+  static const void * data(const T & v) { return &v; }
+
+  static int size(const T &) { return sizeof(T); }
+
+  static char * encode(const T & v, char * out)
+  {
+    std::memcpy(out, &v, sizeof(T));
+    return out + sizeof(T);
+  }
+
+  // memcpy rather than a cast: the bytes tokyo hands back needn't be aligned for T
+  static bool decode(T & v, const char * p, int size)
+  {
+    if (size != static_cast<int>(sizeof(T)))
+      return false;
+    std::memcpy(&v, p, sizeof(T));
+    return true;
+  }
+
+  static int field_size(const T &) { return sizeof(T); }
+
+  static char * encode_field(const T & v, char * out) { return encode(v, out); }
+
+  static const char * decode_field(T & v, const char * p, const char * end)
+  {
+    if (end - p < static_cast<int>(sizeof(T)))
+      return NULL;
+    std::memcpy(&v, p, sizeof(T));
+    return p + sizeof(T);
+  }
+};
+
+template<>
+struct codec<std::string> : codec_base< std::string, codec<std::string> >
+{
+  static const bool direct = true;
+
+  static const void * data(const std::string & v) { return v.data(); }
+
+  static int size(const std::string & v) { return v.size(); }
+
+  static char * encode(const std::string & v, char * out)
+  {
+    std::memcpy(out, v.data(), v.size());
+    return out + v.size();
+  }
+
+  static bool decode(std::string & v, const char * p, int size)
+  {
+    v.assign(p, size);
+    return true;
+  }
+};
+
+// c strings go in without their terminator.  there's nowhere to decode one into
+template<>
+struct codec<const char *> : codec_base< const char *, codec<const char *> >
+{
+  static const bool direct = true;
+
+  static const void * data(const char * v) { return v; }
+
+  static int size(const char * v) { return std::strlen(v); }
+
+  static char * encode(const char * v, char * out)
+  {
+    int size = std::strlen(v);
+    std::memcpy(out, v, size);
+    return out + size;
+  }
+};
+
+template<>
+struct codec<char *> : codec<const char *> {};
+
+// char arrays (string literals, mostly) are strings up to the first nul, or all N chars if there
+// isn't one.  decoding nul-pads, and fails if the bytes won't fit
+template<std::size_t N>
+struct codec<char[N]> : codec_base< char[N], codec<char[N]> >
+{
+  static const bool direct = true;
+
+  static const void * data(const char (&v)[N]) { return v; }
+
+  static int size(const char (&v)[N])
+  {
+    const void * nul = std::memchr(v, 0, N);
+    return nul ? static_cast<const char *>(nul) - v : N;
+  }
+
+  static char * encode(const char (&v)[N], char * out)
+  {
+    int n = size(v);
+    std::memcpy(out, v, n);
+    return out + n;
+  }
+
+  static bool decode(char (&v)[N], const char * p, int size)
+  {
+    if (size > static_cast<int>(N))
+      return false;
+    std::memcpy(v, p, size);
+    std::memset(v + size, 0, N - size);
+    return true;
+  }
+};
+
+template<class T>
+struct codec<std::vector<T>, typename boost::enable_if< is_bitwise<T> >::type>
+: codec_base< std::vector<T>, codec< std::vector<T> > >
+{
+  static const bool direct = true;
+
+  static const void * data(const std::vector<T> & v) { return v.empty() ? NULL : &v[0]; }
+
+  static int size(const std::vector<T> & v) { return v.size() * sizeof(T); }
+
+  static char * encode(const std::vector<T> & v, char * out)
+  {
+    if (!v.empty())
+      std::memcpy(out, &v[0], v.size() * sizeof(T));
+    return out + v.size() * sizeof(T);
+  }
+
+  static bool decode(std::vector<T> & v, const char * p, int size)
+  {
+    if (size % sizeof(T))
+      return false;
+    v.resize(size / sizeof(T));
+    if (size)
+      std::memcpy(&v[0], p, size);
+    return true;
+  }
+};
+
+// anything else in a vector goes element by element, each encoded like a struct field
+template<class T>
+struct codec<std::vector<T>, typename boost::disable_if< is_bitwise<T> >::type>
+: codec_base< std::vector<T>, codec< std::vector<T> > >
+{
+  static int size(const std::vector<T> & v)
+  {
+    int size = 0;
+    for (typename std::vector<T>::const_iterator it = v.begin(); it != v.end(); ++it)
+      size += codec<T>::field_size(*it);
+    return size;
+  }
+
+  static char * encode(const std::vector<T> & v, char * out)
+  {
+    for (typename std::vector<T>::const_iterator it = v.begin(); it != v.end(); ++it)
+      out = codec<T>::encode_field(*it, out);
+    return out;
+  }
+
+  static bool decode(std::vector<T> & v, const char * p, int size)
+  {
+    const char * end = p + size;
+    v.clear();
+    while (p != end)
+    {
+      v.push_back(T());
+      p = codec<T>::decode_field(v.back(), p, end);
+      if (p == NULL)
+        return false;
+    }
+    return true;
+  }
+};
+
+// store an integer as a little-endian base-128 varint (zigzagged first if it's signed), so small
+// numbers take a byte or two instead of sizeof(T).  put(varint<boost::int64_t>(id), ...)
+template<class T>
+struct varint
+{
+  T value;
+
+  varint() : value() {}
+
+  varint(T v) : value(v) {}
+
+  operator T() const { return value; }
+};
+
+template<class T>
+struct codec< varint<T> >
+{
+  static const bool direct = false;
+
+  static const void * data(const varint<T> &) { return NULL; }
+
+  static int size(const varint<T> & v) { return detail::varint_size(detail::zigzag<T>::to(v.value)); }
+
+  static char * encode(const varint<T> & v, char * out)
+  {
+    return detail::varint_encode(detail::zigzag<T>::to(v.value), out);
+  }
+
+  static bool decode(varint<T> & v, const char * p, int size)
+  {
+    return decode_field(v, p, p + size) == p + size;
+  }
+
+  // varints already know where they end
+  static int field_size(const varint<T> & v) { return size(v); }
+
+  static char * encode_field(const varint<T> & v, char * out) { return encode(v, out); }
+
+  static const char * decode_field(varint<T> & v, const char * p, const char * end)
+  {
+    boost::uint64_t n = 0;
+    p = detail::varint_decode(n, p, end);
+    if (p != NULL)
+      v.value = detail::zigzag<T>::from(n);
+    return p;
+  }
+};
+
+// the field walk behind TOKYOOO_CODEC.  Codec::visit(v, f) calls f on each field in order
+template<class T, class Codec>
+struct struct_codec : codec_base<T, Codec>
+{
+  struct sizer
+  {
+    int size;
+    template<class F> void operator() (const F & f) { size += codec<F>::field_size(f); }
+  };
+
+  struct encoder
+  {
+    char * out;
+    template<class F> void operator() (const F & f) { out = codec<F>::encode_field(f, out); }
+  };
+
+  struct decoder
+  {
+    const char * p;
+    const char * end;
+    template<class F> void operator() (F & f) { if (p) p = codec<F>::decode_field(f, p, end); }
+  };
+
+  // visit() takes a T & so one field list serves both ways - sizer and encoder only read
+  static int size(const T & v)
+  {
+    sizer s = { 0 };
+    Codec::visit(const_cast<T &>(v), s);
+    return s.size;
+  }
+
+  static char * encode(const T & v, char * out)
+  {
+    encoder e = { out };
+    Codec::visit(const_cast<T &>(v), e);
+    return e.out;
+  }
+
+  static bool decode(T & v, const char * p, int size)
+  {
+    decoder d = { p, p + size };
+    Codec::visit(v, d);
+    return d.p == d.end;
+  }
+};
+
+// the encoded bytes of one key or value, ready to hand to tokyo cabinet.  direct types are passed
+// through as they are; anything else is encoded into a buffer on the stack, or the heap if it's big
+class packed : public boost::noncopyable
+{
+private:
+
+  const void * data_;
+
+  int size_;
+
+  char stack_[128];
+
+  std::vector<char> heap_;
+
+public:
+
+  template<class T>
+  explicit packed(const T & value)
+  : data_(NULL), size_(codec<T>::size(value))
+  {
+    if (codec<T>::direct)
+    {
+      data_ = codec<T>::data(value);
+      return;
+    }
+    char * out = stack_;
+    if (size_ > static_cast<int>(sizeof(stack_)))
+    {
+      heap_.resize(size_);
+      out = &heap_[0];
+    }
+    codec<T>::encode(value, out);
+    data_ = out;
+  }
+
+  const void * data() const { return data_; }
+
+  int size() const { return size_; }
+};
+
+} // tokyooo
+
+#define TOKYOOO_CODEC_VISIT(r, f, field) f(v.field);
+
+// TOKYOOO_CODEC(point, (x)(y)(label)) - gives point a codec that writes those fields in that order.
+// use it at global scope, after point is defined and before point is first stored
+#define TOKYOOO_CODEC(type, fields)                                       \
+  namespace tokyooo {                                                     \
+  template<> struct is_bitwise< type > : boost::false_type {};            \
+  template<> struct codec< type > : struct_codec< type, codec< type > >   \
+  {                                                                       \
+    template<class F> static void visit(type & v, F & f)                  \
+    {                                                                     \
+      BOOST_PP_SEQ_FOR_EACH(TOKYOOO_CODEC_VISIT, f, fields)               \
+    }                                                                     \
+  };                                                                      \
+  }
+
+#endif // __TOKYOOO_CODEC_HPP__
@@ -0,0 +1,319 @@
+#ifndef __TOKYOOO_FDB_HPP__
+#define __TOKYOOO_FDB_HPP__
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <malloc.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+
+#include <tcutil.h>
+#include <tcfdb.h>
+#include "util.hpp"
+#include "stats.hpp"
+
+namespace tokyooo {
+
+// the options, outside the template so every fdb shares them
+struct fdb_base
+{
+  enum open_options_e
+  {
+    open_default = 0,
+    writer = FDBOWRITER,
+    reader = FDBOREADER,
+    create = FDBOCREAT,
+    trunc = FDBOTRUNC,
+    synchronize = FDBOTSYNC,
+    no_lock = FDBONOLCK,
+    lock_nb = FDBOLCKNB
+  };
+};
+
+// the fixed-length database: an array of Values on disk, indexed by ids from 1 up.  there's no
+// hashing, no bucket array and no per-record header - a record is its id times the width into the
+// file - so it suits dense ids and small fixed-size values.  Value has to be safe to memcpy (see
+// is_bitwise in codec.hpp), and sizeof(Value) is the width, so a file made for one Value won't
+// open as another of a different size.  limsize caps the file, and with it the biggest id
+// (limit_id()); 0 is tcfdb's 256MB.
+template<class Value, class Stats = no_stats>
+class fdb : public fdb_base, public boost::noncopyable
+{
+private:
+
+  BOOST_STATIC_ASSERT(is_bitwise<Value>::value);
+
+  // tcfdb keeps the width in an int32
+  BOOST_STATIC_ASSERT(sizeof(Value) <= 0x7fffffff);
+
+  TCFDB * fdb_;
+
+  Stats stats_;
+
+  result outcome(bool ok, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(fdb_);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+  // tcfdbrange of [lo, hi) cut down to the ids there can be, 1 to limit_id(): tcfdb takes bounds
+  // outside that as an error, and hands back an empty array for it.  null if there's nothing to look
+  // at.  the error code is cleared first, since tcfdb leaves the last one there on success
+  boost::uint64_t * find(boost::int64_t lo, boost::int64_t hi, int max, int & num)
+  {
+    lo = std::max<boost::int64_t>(lo, 1);
+    hi = std::min<boost::int64_t>(hi - 1, limit_id());
+    num = 0;
+    if (lo > hi)
+      return NULL;
+    tcfdbsetecode(fdb_, TCESUCCESS, __FILE__, __LINE__, "find");
+    boost::uint64_t * ret_val = tcfdbrange(fdb_, lo, hi, max, &num);
+    if (ret_val == NULL || (num == 0 && tcfdbecode(fdb_) != TCESUCCESS))
+    {
+      std::free(ret_val);
+      err::go(fdb_);
+    }
+    return ret_val;
+  }
+
+  void init(bool mutexed, boost::int64_t limsize)
+  {
+    if (mutexed)
+      set_mutexed();
+    tcfdbtune(fdb_, sizeof(Value), limsize) || err::go(fdb_);
+  }
+
+public:
+
+  typedef Value value_type;
+
+  fdb( bool mutexed = false, boost::int64_t limsize = 0 )
+  : fdb_(tcfdbnew())
+  {
+    init(mutexed, limsize);
+  }
+
+  fdb( const std::string & path,
+       open_options_e options = open_default,
+       bool mutexed = false,
+       boost::int64_t limsize = 0 )
+  : fdb_(tcfdbnew())
+  {
+    init(mutexed, limsize);
+    open(path, options);
+  }
+
+  ~fdb()
+  {
+    tcfdbclose(fdb_);
+    tcfdbdel(fdb_);
+  }
+
+  void set_mutexed()
+  {
+    tcfdbsetmutex(fdb_) || err::go(fdb_);
+  }
+
+  // an existing file keeps the width it was made with, so that's checked against Value here
+  void open(const std::string & path, open_options_e options = open_default)
+  {
+    typename Stats::timer t(stats_, op_open);
+    tcfdbopen(fdb_, path.c_str(), options) || err::go(fdb_);
+    if (tcfdbwidth(fdb_) != sizeof(Value))
+    {
+      tcfdbclose(fdb_);
+      err::go("tokyooo: " + path + " wasn't made for values of this size");
+    }
+  }
+
+  void close()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcfdbclose(fdb_) || err::go(fdb_);
+  }
+
+  // store or keep
+  void put(boost::int64_t id, const Value & value, put_mode_e put_mode = store)
+  {
+    result r = try_put(id, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  void out(boost::int64_t id)
+  {
+    result r = try_out(id);
+    r.ok() || err::go(r);
+  }
+
+  // copies the record straight into value - no allocation, no decoding
+  bool get(boost::int64_t id, Value & value)
+  {
+    result r = try_get(id, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  // the record at id, which has to be there
+  Value at(boost::int64_t id)
+  {
+    Value ret_val;
+    get(id, ret_val) || err::go("tokyooo: no record at that id");
+    return ret_val;
+  }
+
+  result try_put(boost::int64_t id, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    t.add_bytes(sizeof(Value));
+    bool ok = false;
+    switch (put_mode)
+    {
+    case store: ok = tcfdbput(fdb_, id, &value, sizeof(Value)); break;
+    case keep: ok = tcfdbputkeep(fdb_, id, &value, sizeof(Value)); break;
+    default: err::go("expardon me?"); break;
+    }
+    return outcome(ok, t);
+  }
+
+  result try_out(boost::int64_t id)
+  {
+    typename Stats::timer t(stats_, op_out);
+    return outcome(tcfdbout(fdb_, id), t);
+  }
+
+  result try_get(boost::int64_t id, Value & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    int size = tcfdbget4(fdb_, id, &value, sizeof(Value));
+    if (size == -1)
+      return outcome(false, t);
+    t.add_bytes(size);
+    (size == sizeof(Value)) || err::go("tokyooo: can't decode value of that size");
+    return result();
+  }
+
+  // the ids in [lo, hi) that have records, up to max of them (-1 for all)
+  size_type ids(boost::int64_t lo, boost::int64_t hi, std::vector<boost::int64_t> & out, int max = -1)
+  {
+    typename Stats::timer t(stats_, op_iterate);
+    int num = 0;
+    boost::uint64_t * found = find(lo, hi, max, num);
+    if (found == NULL)
+      return 0;
+    out.insert(out.end(), found, found + num);
+    std::free(found);
+    return num;
+  }
+
+  // the records in [lo, hi) with their ids, in id order
+  size_type range(boost::int64_t lo, boost::int64_t hi, std::vector< std::pair<boost::int64_t, Value> > & out,
+                  int max = -1)
+  {
+    typename Stats::timer t(stats_, op_iterate);
+    int num = 0;
+    boost::uint64_t * found = find(lo, hi, max, num);
+    if (found == NULL)
+      return 0;
+    size_type ret_val = 0;
+    out.reserve(out.size() + num);
+    for (int i = 0; i < num; ++i)
+    {
+      std::pair<boost::int64_t, Value> rec;
+      rec.first = found[i];
+      // gone since tcfdbrange looked, on a shared database
+      if (tcfdbget4(fdb_, rec.first, &rec.second, sizeof(Value)) != sizeof(Value))
+        continue;
+      out.push_back(rec);
+      ++ret_val;
+    }
+    std::free(found);
+    t.add_bytes(ret_val * sizeof(Value));
+    return ret_val;
+  }
+
+  void sync()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcfdbsync(fdb_) || err::go(fdb_);
+  }
+
+  // only the size limit can change - the width is Value's
+  void optimize(boost::int64_t limsize = 0)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcfdboptimize(fdb_, sizeof(Value), limsize) || err::go(fdb_);
+  }
+
+  void vanish()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcfdbvanish(fdb_) || err::go(fdb_);
+  }
+
+  void copy(const std::string & path)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcfdbcopy(fdb_, path.c_str()) || err::go(fdb_);
+  }
+
+  std::string path()
+  {
+    return std::string( tcfdbpath(fdb_) );
+  }
+
+  size_type size()
+  {
+    return tcfdbrnum(fdb_);
+  }
+
+  size_type fsize()
+  {
+    return tcfdbfsiz(fdb_);
+  }
+
+  // the lowest and highest ids in use, 0 if there are none
+  boost::int64_t min_id()
+  {
+    return tcfdbmin(fdb_);
+  }
+
+  boost::int64_t max_id()
+  {
+    return tcfdbmax(fdb_);
+  }
+
+  // the highest id the size limit leaves room for
+  boost::int64_t limit_id()
+  {
+    return tcfdblimid(fdb_);
+  }
+
+  TCFDB * native()
+  {
+    return fdb_;
+  }
+
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_FDB_HPP__
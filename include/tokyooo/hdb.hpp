@@ -7,25 +7,27 @@
 #include <limits>
 #include <malloc.h>
 #include <cmath>
+#include <vector>
+#include <iterator>
+#include <algorithm>
 
 #include <boost/noncopyable.hpp>
 #include <boost/cstdint.hpp>
+#include <boost/core/uncaught_exceptions.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <tcutil.h>
 #include <tchdb.h>
 #include "util.hpp"
 #include "map.hpp"
+#include "stats.hpp"
+#include "store.hpp"
 
 namespace tokyooo {
 
-class hdb : public boost::noncopyable
+// the options, outside the template so every basic_hdb shares them
+struct hdb_base
 {
-private:
-
-  TCHDB * hdb_;
-
-public:
-
   enum tune_options_e
   {
     tune_default = 0,
@@ -46,14 +48,69 @@ public:
     lock_nb = HDBOLCKNB
   };
 
-  hdb( bool mutexed = false,
+  // what tune() and optimize() take
+  struct tuning
+  {
+    boost::int64_t bnum;
+    char apow;
+    char fpow;
+    tune_options_e opts;
+  };
+
+  // tuning for a file expected to hold about records records of key_size + value_size bytes each.
+  // tchdb wants half a bucket to four a record, and this gives two, so the file can grow to four
+  // times records before chains get long.  a record is padded out to 1 << apow bytes, and this picks
+  // the biggest alignment that wastes no more than about a sixteenth of one - more room to grow a
+  // value in place, without bloating small records.  large once the file could pass 2GB
+  static tuning tuning_for(boost::uint64_t records, std::size_t value_size, std::size_t key_size = 16)
+  {
+    tuning ret_val;
+    ret_val.bnum = std::max<boost::int64_t>(131071, boost::int64_t(records) * 2);
+    std::size_t record = key_size + value_size + 16; // about what tchdb's record header takes
+    ret_val.apow = 4;
+    while (ret_val.apow < 10 && (std::size_t(8) << (ret_val.apow + 1)) <= record)
+      ++ret_val.apow;
+    ret_val.fpow = records >= 10000000 ? 12 : 10;
+    boost::uint64_t padded = (record + (std::size_t(1) << ret_val.apow) - 1) >> ret_val.apow << ret_val.apow;
+    ret_val.opts = records * padded + ret_val.bnum * 4 >= (boost::uint64_t(1) << 31) ? large : tune_default;
+    return ret_val;
+  }
+};
+
+// Stats decides what gets recorded about each call - nothing, by default.  basic_hdb<op_stats>
+// counts and times them, see stats.hpp
+template<class Stats = no_stats>
+class basic_hdb : public hdb_base, public boost::noncopyable
+{
+private:
+
+  TCHDB * hdb_;
+
+  Stats stats_;
+
+  bool mutexed_;
+
+  // what a try_ call returns once tchdb has answered.  misses and keep conflicts aren't errors
+  result outcome(bool ok, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(hdb_);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+public:
+
+  basic_hdb( bool mutexed = false,
        boost::int64_t bnum = 131071,
        char apow = 4,
        char fpow = 10,
        tune_options_e opts = tune_default,
        int rcnum = 0,
        boost::int64_t xmsize = 67108864 )
-  : hdb_(tchdbnew())
+  : hdb_(tchdbnew()), mutexed_(false)
   {
     if (mutexed)
       set_mutexed();
@@ -62,7 +119,7 @@ public:
     set_extra_mm(xmsize);
   }
 
-  hdb( const std::string & path,
+  basic_hdb( const std::string & path,
        open_options_e options = open_default,
        bool mutexed = false,
        boost::int64_t bnum = 131071,
@@ -71,7 +128,7 @@ public:
        tune_options_e opts = tune_default,
        int rcnum = 0,
        boost::int64_t xmsize = 67108864 )
-  : hdb_(tchdbnew())
+  : hdb_(tchdbnew()), mutexed_(false)
   {
     if (mutexed)
       set_mutexed();
@@ -81,7 +138,7 @@ public:
     open(path, options);
   }
 
-  ~hdb()
+  ~basic_hdb()
   {
     tchdbclose(hdb_);
     tchdbdel(hdb_);
@@ -90,6 +147,12 @@ public:
   void set_mutexed()
   {
     tchdbsetmutex(hdb_) || err::go(hdb_);
+    mutexed_ = true;
+  }
+
+  bool mutexed() const
+  {
+    return mutexed_;
   }
 
   void tune( boost::int64_t bnum, char apow, char fpow, tune_options_e opts )
@@ -97,6 +160,12 @@ public:
     tchdbtune(hdb_, bnum, apow, fpow, opts) || err::go(hdb_);
   }
 
+  // before open, and only takes effect if that creates the file - see tuning_for
+  void tune(const tuning & t)
+  {
+    tune(t.bnum, t.apow, t.fpow, t.opts);
+  }
+
   void set_cache(int rcnum)
   {
     tchdbsetcache(hdb_, rcnum) || err::go(hdb_);
@@ -107,91 +176,436 @@ public:
     tchdbsetxmsiz(hdb_, xmsize) || err::go(hdb_);
   }
 
+  // before open: defragment on the side of writes, every dfunit new free blocks.  0, the default,
+  // never does - defrag() and maintained_hdb do it off the write path instead
+  void set_defrag_unit(boost::int32_t dfunit)
+  {
+    tchdbsetdfunit(hdb_, dfunit) || err::go(hdb_);
+  }
+
   void open(const std::string & path, open_options_e options = open_default)
   {
+    typename Stats::timer t(stats_, op_open);
     tchdbopen(hdb_, path.c_str(), options) || err::go(hdb_);
   }
 
   void close()
   {
+    typename Stats::timer t(stats_, op_admin);
     tchdbclose(hdb_) || err::go(hdb_);
   }
 
-  // using this for structs and stuff - maybe alignment problems?  ymmv
+  // keys and values of any type with a codec<> - see codec.hpp
   template<class Key, class Value>
   void put(const Key & key, const Value & value, put_mode_e put_mode = store)
   {
+    result r = try_put(key, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    result r = try_get(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  // copies the value straight into your buffer with tchdbget3, no allocation.  returns the full
+  // size of the value (bigger than capacity means it got cut short) or -1 if there's no such record
+  template<class Key>
+  int get_into(const Key & key, void * buffer, int capacity)
+  {
+    int size = -1;
+    result r = try_get_into(key, buffer, capacity, size);
+    (r.ok() || r.not_found()) || err::go(r);
+    return size;
+  }
+
+  // points value at a copy in this thread's scratch buffer - good until this thread's next get_view
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    result r = try_get_view(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    int ret_val = -1;
+    result r = try_vsize(key, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  // the same calls without the exceptions: each returns how it went, and only hands back a value
+  // if it went ok().  a missing record is r.not_found(), a keep put on an existing one r.exists()
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key), v(value);
+    t.add_bytes(k.size() + v.size());
+    bool ok = false;
     switch (put_mode)
     {
-    case store: tchdbput(hdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)) || err::go(hdb_); break;
-    case keep: tchdbputkeep(hdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)) || err::go(hdb_); break;
-    case cat: tchdbputcat(hdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)) || err::go(hdb_); break;
-    case async: tchdbputasync(hdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value) ) || err::go(hdb_); break;
+    case store: ok = tchdbput(hdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case keep: ok = tchdbputkeep(hdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case cat: ok = tchdbputcat(hdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case async: ok = tchdbputasync(hdb_, k.data(), k.size(), v.data(), v.size()); break;
     default: err::go("expardon me?"); break;
     }
+    return outcome(ok, t);
   }
 
   template<class Key>
-  void out(const Key & key)
+  result try_out(const Key & key)
   {
-    tchdbout(hdb_, ser::cptr(key), ser::len(key)) || err::go(hdb_);
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tchdbout(hdb_, k.data(), k.size()), t);
   }
 
+  // bytes that don't decode as a Value still throw - that's a bug, not a miss
   template<class Key, class Value>
-  bool get(const Key & key, Value & value)
+  result try_get(const Key & key, Value & value)
   {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
     int size = 0;
-    void * p = tchdbget( hdb_, ser::cptr(key), ser::len(key), &size );
+    void * p = tchdbget( hdb_, k.data(), k.size(), &size );
     if (p == NULL)
-      return false;
-    ser::assign(value, p, size);
+      return outcome(false, t);
+    t.add_bytes(k.size() + size);
+    try
+    {
+      unpack(value, p, size);
+    }
+    catch (...)
+    {
+      std::free(p);
+      throw;
+    }
     std::free(p);
-    return true;
+    return result();
   }
 
+  // size as get_into would return it
   template<class Key>
-  int vsize(const Key & key)
+  result try_get_into(const Key & key, void * buffer, int capacity, int & size)
   {
-    int ret_val = tchdbvsiz( hdb_, ser::cptr(key), ser::len(key) );
-    (ret_val != -1) || err::go(hdb_);
-    return ret_val;
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    int got = tchdbget3( hdb_, k.data(), k.size(), buffer, capacity );
+    if (got == -1)
+      return outcome(false, t);
+    t.add_bytes(k.size() + got);
+    size = got;
+    if (got == capacity)
+    {
+      int full = tchdbvsiz( hdb_, k.data(), k.size() );
+      if (full > got)
+        size = full;
+    }
+    return result();
+  }
+
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    std::vector<char> & buffer = thread_buffer();
+    int size = -1;
+    result r = try_get_into(key, &buffer[0], buffer.size(), size);
+    while (r.ok() && size > static_cast<int>(buffer.size()))
+    {
+      buffer.resize(size);
+      r = try_get_into(key, &buffer[0], buffer.size(), size);
+    }
+    if (r.ok())
+      value = view(&buffer[0], size);
+    return r;
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tchdbvsiz( hdb_, k.data(), k.size() );
+    if (got == -1)
+      return outcome(false, t);
+    size = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tchdbaddint(hdb_, k.data(), k.size(), value);
+    if (got == std::numeric_limits<int>::min())
+      return outcome(false, t);
+    sum = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    double got = tchdbadddouble(hdb_, k.data(), k.size(), value);
+    if (std::isnan(got))
+      return outcome(false, t);
+    sum = got;
+    return result();
+  }
+
+  // walks the whole database with tchdbiternext3, refilling the same two buffers at every step, so
+  // a scan costs one traversal and no allocations per record.  the records it hands out are views
+  // into those buffers and go stale on the next increment.  tchdb only has one iteration cursor per
+  // database, so this is a single-pass input iterator: copies share a position, and calling begin()
+  // again restarts every walk in progress.
+  class iterator
+  {
+  private:
+
+    struct state : public boost::noncopyable
+    {
+      TCHDB * db;
+      Stats & stats;
+      TCXSTR * kbuf;
+      TCXSTR * vbuf;
+      tokyooo::record rec;
+
+      state(TCHDB * db, Stats & stats) : db(db), stats(stats), kbuf(tcxstrnew()), vbuf(tcxstrnew()) {}
+
+      ~state()
+      {
+        tcxstrdel(kbuf);
+        tcxstrdel(vbuf);
+      }
+    };
+
+    boost::shared_ptr<state> state_; // empty at the end
+
+    void next()
+    {
+      typename Stats::timer t(state_->stats, op_iterate);
+      if (!tchdbiternext3(state_->db, state_->kbuf, state_->vbuf))
+      {
+        (tchdbecode(state_->db) == TCENOREC) || err::go(state_->db);
+        state_.reset();
+        return;
+      }
+      state_->rec.key = view(tcxstrptr(state_->kbuf), tcxstrsize(state_->kbuf));
+      state_->rec.value = view(tcxstrptr(state_->vbuf), tcxstrsize(state_->vbuf));
+      t.add_bytes(state_->rec.key.size + state_->rec.value.size);
+    }
+
+  public:
+
+    typedef std::input_iterator_tag iterator_category;
+    typedef tokyooo::record value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const tokyooo::record * pointer;
+    typedef const tokyooo::record & reference;
+
+    iterator() {}
+
+    iterator(TCHDB * db, Stats & stats)
+    : state_(new state(db, stats))
+    {
+      tchdbiterinit(db) || err::go(db);
+      next();
+    }
+
+    reference operator* () const { return state_->rec; }
+
+    pointer operator-> () const { return &state_->rec; }
+
+    iterator & operator++ ()
+    {
+      next();
+      return *this;
+    }
+
+    bool operator== (const iterator & other) const { return state_ == other.state_; }
+
+    bool operator!= (const iterator & other) const { return state_ != other.state_; }
+  };
+
+  // same walk as iterator, but only shows you the keys
+  class key_iterator
+  {
+  private:
+
+    iterator it_;
+
+  public:
+
+    typedef std::input_iterator_tag iterator_category;
+    typedef view value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const view * pointer;
+    typedef const view & reference;
+
+    key_iterator() {}
+
+    explicit key_iterator(const iterator & it) : it_(it) {}
+
+    reference operator* () const { return it_->key; }
+
+    pointer operator-> () const { return &it_->key; }
+
+    key_iterator & operator++ ()
+    {
+      ++it_;
+      return *this;
+    }
+
+    bool operator== (const key_iterator & other) const { return it_ == other.it_; }
+
+    bool operator!= (const key_iterator & other) const { return it_ != other.it_; }
+  };
+
+  struct key_range
+  {
+    TCHDB * db;
+    Stats * stats;
+
+    key_iterator begin() const { return key_iterator(iterator(db, *stats)); }
+
+    key_iterator end() const { return key_iterator(); }
+  };
+
+  iterator begin()
+  {
+    return iterator(hdb_, stats_);
   }
 
-  // TODO: iterators
+  iterator end()
+  {
+    return iterator();
+  }
+
+  // for (view k : h.keys()) ...
+  key_range keys()
+  {
+    key_range r = { hdb_, &stats_ };
+    return r;
+  }
 
   template<class Key>
   int add(const Key & key, int value)
   {
-    int ret_val = tchdbaddint(hdb_, ser::cptr(key), ser::len(key), value);
-    ( ret_val == std::numeric_limits<int>::min() ) || err::go(hdb_);
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
     return ret_val;
   }
 
   template<class Key>
-  int add(const Key & key, double value)
+  double add(const Key & key, double value)
   {
-    double ret_val = tchdbadddouble(hdb_, ser::cptr(key), ser::len(key), value);
-    !std::isnan(ret_val) || err::go(hdb_);
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
     return ret_val;
   }
 
+  // one transaction at a time, so others wait here for this one to finish
+  class transaction : public boost::noncopyable
+  {
+  private:
+
+    basic_hdb & hdb_;
+
+    bool open_;
+
+  public:
+
+    explicit transaction(basic_hdb & h)
+    : hdb_(h), open_(false)
+    {
+      tchdbtranbegin(hdb_.native()) || err::go(hdb_.native());
+      open_ = true;
+    }
+
+    ~transaction()
+    {
+      if (open_)
+        tchdbtranabort(hdb_.native());
+    }
+
+    void commit()
+    {
+      typename Stats::timer t(hdb_.stats(), op_misc);
+      open_ = false;
+      tchdbtrancommit(hdb_.native()) || err::go(hdb_.native());
+    }
+
+    void abort()
+    {
+      open_ = false;
+      tchdbtranabort(hdb_.native()) || err::go(hdb_.native());
+    }
+  };
+
   void sync()
   {
+    typename Stats::timer t(stats_, op_admin);
     tchdbsync(hdb_) || err::go(hdb_);
   }
 
   void optimize( boost::int64_t bnum, char apow, char fpow, tune_options_e opts )
   {
+    typename Stats::timer t(stats_, op_admin);
     tchdboptimize(hdb_, bnum, apow, fpow, opts) || err::go(hdb_);
   }
 
+  // rewrites the whole file with writers locked out the whole time - auto_tuned_hdb does it without
+  void optimize(const tuning & t)
+  {
+    optimize(t.bnum, t.apow, t.fpow, t.opts);
+  }
+
+  // moves up to step records into the free space before them, holding the write lock while it
+  // does; the file shrinks once a pass reaches the end.  0 or less does a whole pass, taking the
+  // lock a little at a time
+  void defrag(boost::int64_t step = 0)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tchdbdefrag(hdb_, step) || err::go(hdb_);
+  }
+
   void vanish()
   {
+    typename Stats::timer t(stats_, op_admin);
     tchdbvanish(hdb_) || err::go(hdb_);
   }
 
   void copy(const std::string & path)
   {
+    typename Stats::timer t(stats_, op_admin);
     tchdbcopy(hdb_, path.c_str()) || err::go(hdb_);
   }
 
@@ -210,13 +624,244 @@ public:
     return tchdbfsiz(hdb_);
   }
 
+  boost::int64_t bucket_count()
+  {
+    return tchdbbnum(hdb_);
+  }
+
+  // the free blocks tchdb knows of, up to its pool's size - a rough count of the holes defrag
+  // fills.  there's no call for it, so this reads TCHDB's fbpnum, which ties it to tchdb's struct
+  // layout; and it's read without tchdb's lock while writers change it, so it's only approximate
+  boost::int32_t free_blocks()
+  {
+    return *static_cast<volatile boost::int32_t *>(&hdb_->fbpnum);
+  }
+
+  // records per bucket.  past about 2 lookups start walking long chains, and it's time to optimize
+  double load_factor()
+  {
+    boost::int64_t bnum = bucket_count();
+    return bnum > 0 ? double(size()) / bnum : 0;
+  }
+
   TCHDB * native()
   {
     return hdb_;
   }
 
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  // op_stats copies share their counts, so this is how several databases report as one
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+
+  // queues up puts/outs/adds and applies them inside one transaction, so a big ingest pays for one
+  // commit every flush_size records instead of one per record.  pending ops are committed when the
+  // batch goes out of scope, or thrown away if it's going out of scope because of an exception.
+  // call commit() yourself if you want to hear about errors - the destructor can't throw them.
+  class batch : public boost::noncopyable
+  {
+  private:
+
+    enum op_type_e
+    {
+      op_put,
+      op_out,
+      op_add_int,
+      op_add_double
+    };
+
+    struct op
+    {
+      op_type_e type;
+      put_mode_e put_mode;
+      std::string::size_type offset; // key, then value, live in data_ starting here
+      int ksize;
+      int vsize;
+      int ivalue;
+      double dvalue;
+    };
+
+    basic_hdb & hdb_;
+
+    std::size_t flush_size_;
+
+    std::vector<op> ops_;
+
+    std::string data_;
+
+    unsigned int uncaught_;
+
+    op & push(op_type_e type, const void * kbuf, int ksize, const void * vbuf = NULL, int vsize = 0)
+    {
+      op o;
+      o.type = type;
+      o.put_mode = store;
+      o.offset = data_.size();
+      o.ksize = ksize;
+      o.vsize = vsize;
+      o.ivalue = 0;
+      o.dvalue = 0;
+      data_.append(reinterpret_cast<const char *>(kbuf), ksize);
+      if (vsize)
+        data_.append(reinterpret_cast<const char *>(vbuf), vsize);
+      ops_.push_back(o);
+      return ops_.back();
+    }
+
+    void reset()
+    {
+      ops_.clear();
+      data_.clear();
+    }
+
+    void maybe_flush()
+    {
+      if (ops_.size() >= flush_size_)
+        commit();
+    }
+
+    // keep on an existing key and out on a missing one aren't worth losing the whole batch over
+    bool apply(const op & o)
+    {
+      TCHDB * db = hdb_.native();
+      const char * k = data_.data() + o.offset;
+      const char * v = k + o.ksize;
+      switch (o.type)
+      {
+      case op_put:
+        switch (o.put_mode)
+        {
+        case store: return tchdbput(db, k, o.ksize, v, o.vsize);
+        case keep: return tchdbputkeep(db, k, o.ksize, v, o.vsize) || tchdbecode(db) == TCEKEEP;
+        case cat: return tchdbputcat(db, k, o.ksize, v, o.vsize);
+        case async: return tchdbputasync(db, k, o.ksize, v, o.vsize);
+        default: break;
+        }
+        break;
+      case op_out: return tchdbout(db, k, o.ksize) || tchdbecode(db) == TCENOREC;
+      case op_add_int: return tchdbaddint(db, k, o.ksize, o.ivalue) != std::numeric_limits<int>::min();
+      case op_add_double: return !std::isnan(tchdbadddouble(db, k, o.ksize, o.dvalue));
+      }
+      return false;
+    }
+
+  public:
+
+    batch(basic_hdb & h, std::size_t flush_size = 4096)
+    : hdb_(h), flush_size_(flush_size ? flush_size : 1), uncaught_(boost::core::uncaught_exceptions())
+    {
+      ops_.reserve(flush_size_);
+    }
+
+    ~batch()
+    {
+      if (boost::core::uncaught_exceptions() > uncaught_)
+      {
+        abort();
+        return;
+      }
+      try
+      {
+        commit();
+      }
+      catch (...) {}
+    }
+
+    template<class Key, class Value>
+    void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+    {
+      packed k(key), v(value);
+      if (put_mode != store && put_mode != keep && put_mode != cat && put_mode != async)
+        err::go("expardon me?");
+      push(op_put, k.data(), k.size(), v.data(), v.size()).put_mode = put_mode;
+      maybe_flush();
+    }
+
+    template<class Key>
+    void out(const Key & key)
+    {
+      packed k(key);
+      push(op_out, k.data(), k.size());
+      maybe_flush();
+    }
+
+    template<class Key>
+    void add(const Key & key, int value)
+    {
+      packed k(key);
+      push(op_add_int, k.data(), k.size()).ivalue = value;
+      maybe_flush();
+    }
+
+    template<class Key>
+    void add(const Key & key, double value)
+    {
+      packed k(key);
+      push(op_add_double, k.data(), k.size()).dvalue = value;
+      maybe_flush();
+    }
+
+    // apply everything pending in one transaction.  on failure the transaction is rolled back,
+    // the pending ops are dropped and the error is thrown
+    void commit()
+    {
+      if (ops_.empty())
+        return;
+      typename Stats::timer t(hdb_.stats(), op_misc);
+      t.add_bytes(data_.size());
+      TCHDB * db = hdb_.native();
+      tchdbtranbegin(db) || err::go(db);
+      for (typename std::vector<op>::const_iterator it = ops_.begin(); it != ops_.end(); ++it)
+      {
+        if (!apply(*it))
+        {
+          int ecode = tchdbecode(db);
+          tchdbtranabort(db);
+          reset();
+          err::go(tchdberrmsg(ecode));
+        }
+      }
+      if (!tchdbtrancommit(db))
+      {
+        reset();
+        err::go(db);
+      }
+      reset();
+    }
+
+    // drop whatever hasn't been committed yet
+    void abort()
+    {
+      reset();
+    }
+
+    std::size_t pending() const
+    {
+      return ops_.size();
+    }
+
+    void set_flush_size(std::size_t flush_size)
+    {
+      flush_size_ = flush_size ? flush_size : 1;
+      maybe_flush();
+    }
+  };
+
 };
 
+template<class Stats>
+struct supports_transactions< basic_hdb<Stats> > : boost::true_type {};
+
+typedef basic_hdb<> hdb;
+
+BOOST_CONCEPT_ASSERT((Store<hdb>));
+
 } // tokyooo
 
 #endif // __TOKYOOO_HDB_HPP__
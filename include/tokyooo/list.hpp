@@ -3,6 +3,8 @@
 
 #include <malloc.h>
 #include <iterator>
+#include <vector>
+#include <boost/config.hpp>
 #include <tcutil.h>
 #include "util.hpp"
 
@@ -16,13 +18,89 @@ private:
 
 public:
 
+  // views straight into the list's storage, no copies.  anything that adds or removes items
+  // invalidates them.  * hands back the view itself, not a reference to one kept in the iterator,
+  // so reverse_iterator and the std algorithms never see one that's gone
+  class const_iterator
+  {
+  private:
+
+    const TCLIST * list_;
+
+    int index_;
+
+    mutable view cur_; // only for ->
+
+    view at(int index) const
+    {
+      const TCLISTDATUM & d = list_->array[list_->start + index];
+      return view(d.ptr, d.size);
+    }
+
+  public:
+
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef view value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const view * pointer;
+    typedef view reference;
+
+    const_iterator() : list_(NULL), index_(0) {}
+
+    const_iterator(const TCLIST * list, int index) : list_(list), index_(index) {}
+
+    reference operator* () const { return at(index_); }
+
+    pointer operator-> () const
+    {
+      cur_ = at(index_);
+      return &cur_;
+    }
+
+    view operator[] (difference_type n) const { return at(index_ + n); }
+
+    const_iterator & operator++ () { ++index_; return *this; }
+
+    const_iterator & operator-- () { --index_; return *this; }
+
+    const_iterator operator++ (int) { const_iterator ret_val = *this; ++index_; return ret_val; }
+
+    const_iterator operator-- (int) { const_iterator ret_val = *this; --index_; return ret_val; }
+
+    const_iterator & operator+= (difference_type n) { index_ += n; return *this; }
+
+    const_iterator & operator-= (difference_type n) { index_ -= n; return *this; }
+
+    const_iterator operator+ (difference_type n) const { return const_iterator(list_, index_ + n); }
+
+    const_iterator operator- (difference_type n) const { return const_iterator(list_, index_ - n); }
+
+    friend const_iterator operator+ (difference_type n, const const_iterator & it) { return it + n; }
+
+    difference_type operator- (const const_iterator & other) const { return index_ - other.index_; }
+
+    bool operator== (const const_iterator & other) const { return index_ == other.index_; }
+
+    bool operator!= (const const_iterator & other) const { return index_ != other.index_; }
+
+    bool operator< (const const_iterator & other) const { return index_ < other.index_; }
+
+    bool operator> (const const_iterator & other) const { return index_ > other.index_; }
+
+    bool operator<= (const const_iterator & other) const { return index_ <= other.index_; }
+
+    bool operator>= (const const_iterator & other) const { return index_ >= other.index_; }
+  };
+
+  typedef const_iterator iterator;
+
   list() : list_(tclistnew()) {}
 
   list(int num) : list_(tclistnew2(num)) {}
 
   template< class InputIterator >
   list( InputIterator begin, InputIterator end )
-  : list_(tclistnew())
+  : list_(tclistnew2(detail::distance(begin, end)))
   {
     put_all(begin, end);
   }
@@ -34,14 +112,38 @@ public:
 
   list & operator= (const list & other)
   {
-    tclistdel(list_);
-    list_ = tclistdup(other.list_);
+    TCLIST * tmp = tclistdup(other.list_);
+    if (list_ != NULL)
+      tclistdel(list_);
+    list_ = tmp;
+    return *this;
+  }
+
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+  // a moved-from list can only be assigned to or destroyed
+  list(list && other)
+  : list_(other.list_)
+  {
+    other.list_ = NULL;
+  }
+
+  list & operator= (list && other)
+  {
+    if (this != &other)
+    {
+      if (list_ != NULL)
+        tclistdel(list_);
+      list_ = other.list_;
+      other.list_ = NULL;
+    }
     return *this;
   }
+#endif
 
   ~list()
   {
-    tclistdel(list_);
+    if (list_ != NULL)
+      tclistdel(list_);
   }
 
   size_type size() const
@@ -56,14 +158,15 @@ public:
     const void * p = tclistval( list_, index, &size );
     if (p == NULL)
       return false;
-    ser::assign(value, p, size);
+    unpack(value, p, size);
     return true;
   }
 
   template<class Value>
   void push(const Value & value)
   {
-    tclistpush( list_, ser::cptr(value), ser::len(value) );
+    packed v(value);
+    tclistpush( list_, v.data(), v.size() );
   }
 
   bool pop()
@@ -80,18 +183,26 @@ public:
   bool pop(Value & value)
   {
     int size = 0;
-    const void * p = tclistpop( list_, &size );
+    void * p = tclistpop( list_, &size );
     if (p == NULL)
       return false;
-    ser::assign(value, p, size);
+    unpack(value, p, size);
     std::free(p);
     return true;
   }
 
+  template< class InputIterator >
+  void put_all(InputIterator begin, InputIterator end)
+  {
+    for (; begin != end; ++begin)
+      push(*begin);
+  }
+
   template<class Value>
   void unshift(const Value & value)
   {
-    tclistunshift( list_, ser::cptr(value), ser::len(value) );
+    packed v(value);
+    tclistunshift( list_, v.data(), v.size() );
   }
 
   bool shift()
@@ -111,7 +222,7 @@ public:
     void * p = tclistshift( list_, &size );
     if (p == NULL)
       return false;
-    ser::assign(value, p, size);
+    unpack(value, p, size);
     std::free(p);
     return true;
   }
@@ -119,7 +230,8 @@ public:
   template<class Value>
   void insert(const Value & value, int index)
   {
-    tclistinsert( list_, index, ser::cptr(value), ser::len(value) );
+    packed v(value);
+    tclistinsert( list_, index, v.data(), v.size() );
   }
 
   bool remove(int index)
@@ -136,10 +248,10 @@ public:
   bool remove(Value & value, int index)
   {
     int size = 0;
-    const void * p = tclistremove( list_, index, &size );
+    void * p = tclistremove( list_, index, &size );
     if (p == NULL)
       return false;
-    ser::assign(value, p, size);
+    unpack(value, p, size);
     std::free(p);
     return true;
   }
@@ -147,7 +259,8 @@ public:
   template<class Value>
   void set(const Value & value, int index)
   {
-    tclistover(list_, index, ser::cptr(value), ser::len(value));
+    packed v(value);
+    tclistover(list_, index, v.data(), v.size());
   }
 
   void sort()
@@ -158,13 +271,15 @@ public:
   template<class Value>
   int find(const Value & value)
   {
-    return tclistsearch(list_, ser::cptr(value), ser::len(value));
+    packed v(value);
+    return tclistsearch(list_, v.data(), v.size());
   }
 
   template<class Value>
   int search(const Value & value)
   {
-    return tclistbsearch(list_, ser::cptr(value), ser::len(value));
+    packed v(value);
+    return tclistbsearch(list_, v.data(), v.size());
   }
 
   void clear()
@@ -172,6 +287,23 @@ public:
     tclistclear(list_);
   }
 
+  const_iterator begin() const { return const_iterator(list_, 0); }
+
+  const_iterator end() const { return const_iterator(list_, tclistnum(list_)); }
+
+  // every item decoded in one pass, into a vector allocated once
+  template<class Value>
+  std::vector<Value> to_vector() const
+  {
+    std::vector<Value> ret_val(tclistnum(list_));
+    for (int i = 0; i < static_cast<int>(ret_val.size()); ++i)
+    {
+      const TCLISTDATUM & d = list_->array[list_->start + i];
+      unpack(ret_val[i], d.ptr, d.size);
+    }
+    return ret_val;
+  }
+
   void swap(list & other)
   {
     TCLIST * tmp = list_;
@@ -0,0 +1,466 @@
+#ifndef __TOKYOOO_MAINTAINED_HDB_HPP__
+#define __TOKYOOO_MAINTAINED_HDB_HPP__
+
+#include <string>
+#include <exception>
+#include <algorithm>
+#include <time.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <tchdb.h>
+#include "util.hpp"
+#include "hdb.hpp"
+#include "store.hpp"
+
+namespace tokyooo {
+
+// an hdb with a thread of its own that does the upkeep callers would otherwise stop for:
+//
+//   sync       every sync_interval, or as soon as sync_bytes have been written through this since
+//              the last one, whichever comes first.  a zero turns either off
+//   defrag     while tchdb's free block pool holds min_free_blocks or more, defrag_step records at
+//              a time (see hdb::defrag), each step holding the write lock only as long as it takes.
+//              between steps the thread rests long enough to keep its share of the time at
+//              defrag_budget - 0.05 is a twentieth of the time, and of the i/o and cpu that goes with
+//              it.  a defrag_step of 0 turns it off
+//
+// the hdb has to be mutexed, since the thread works on it alongside everybody else.  calls made
+// through this are timed, and statistics() has the longest, next to what the upkeep has cost and
+// given back; calls made on the hdb directly aren't counted.  it's a Store (see store.hpp).
+class maintained_hdb : public boost::noncopyable
+{
+public:
+
+  struct stats
+  {
+    boost::uint64_t syncs;
+    boost::uint64_t sync_usec;            // total time spent syncing
+    boost::uint64_t max_sync_usec;
+    boost::uint64_t defrag_steps;
+    boost::uint64_t defrag_usec;          // total time spent defragmenting
+    boost::uint64_t max_defrag_usec;      // the longest step
+    boost::uint64_t reclaimed_bytes;      // how much smaller defragmenting has made the file
+    boost::uint64_t failures;             // syncs and steps that threw
+    std::string last_error;
+    boost::uint64_t max_pause_usec;       // the longest call made through this
+    boost::uint64_t unsynced_bytes;       // written through this since the last sync
+    boost::int32_t free_blocks;           // in tchdb's free block pool right now: the fragmentation
+    size_type fsize;
+  };
+
+private:
+
+  hdb & hdb_;
+
+  boost::posix_time::time_duration sync_interval_;
+
+  boost::uint64_t sync_bytes_;
+
+  boost::int64_t defrag_step_;
+
+  double defrag_budget_;
+
+  boost::int32_t min_free_blocks_;
+
+  boost::atomic<boost::uint64_t> unsynced_;
+
+  boost::atomic<boost::uint64_t> max_pause_ns_;
+
+  boost::mutex mutex_;                    // stats_, stop_
+
+  boost::condition_variable wake_;
+
+  stats stats_;
+
+  bool stop_;
+
+  boost::scoped_ptr<boost::thread> thread_;
+
+  static boost::uint64_t now_ns()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return boost::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  // times a call made through this
+  class pause
+  {
+  private:
+
+    boost::atomic<boost::uint64_t> & max_;
+
+    boost::uint64_t start_;
+
+  public:
+
+    explicit pause(boost::atomic<boost::uint64_t> & max)
+    : max_(max), start_(now_ns()) {}
+
+    ~pause()
+    {
+      boost::uint64_t ns = now_ns() - start_;
+      boost::uint64_t seen = max_.load(boost::memory_order_relaxed);
+      while (ns > seen && !max_.compare_exchange_weak(seen, ns, boost::memory_order_relaxed)) {}
+    }
+  };
+
+  // wakes the thread on the write that takes the count past sync_bytes
+  void wrote(std::size_t bytes)
+  {
+    boost::uint64_t before = unsynced_.fetch_add(bytes, boost::memory_order_relaxed);
+    if (sync_bytes_ && before < sync_bytes_ && before + bytes >= sync_bytes_)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      wake_.notify_one();
+    }
+  }
+
+  bool sync_due(const boost::posix_time::ptime & last_sync) const
+  {
+    if (sync_bytes_ && unsynced_.load(boost::memory_order_relaxed) >= sync_bytes_)
+      return true;
+    return !sync_interval_.is_special() && sync_interval_.ticks() > 0
+      && boost::posix_time::microsec_clock::universal_time() - last_sync >= sync_interval_;
+  }
+
+  bool defrag_due()
+  {
+    return defrag_step_ > 0 && free_blocks() >= min_free_blocks_;
+  }
+
+  void failed(const std::exception & e)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ++stats_.failures;
+    stats_.last_error = e.what();
+  }
+
+  void sync_once()
+  {
+    boost::uint64_t bytes = unsynced_.exchange(0, boost::memory_order_relaxed);
+    boost::uint64_t start = now_ns();
+    try
+    {
+      hdb_.sync();
+    }
+    catch (std::exception & e)
+    {
+      unsynced_.fetch_add(bytes, boost::memory_order_relaxed);
+      failed(e);
+      return;
+    }
+    boost::uint64_t usec = (now_ns() - start) / 1000;
+    boost::mutex::scoped_lock lock(mutex_);
+    ++stats_.syncs;
+    stats_.sync_usec += usec;
+    stats_.max_sync_usec = std::max(stats_.max_sync_usec, usec);
+  }
+
+  // returns how long it took, in ns
+  boost::uint64_t defrag_once()
+  {
+    size_type before = hdb_.fsize();
+    boost::uint64_t start = now_ns();
+    try
+    {
+      hdb_.defrag(defrag_step_);
+    }
+    catch (std::exception & e)
+    {
+      failed(e);
+      return now_ns() - start;
+    }
+    boost::uint64_t ns = now_ns() - start;
+    size_type after = hdb_.fsize();
+    boost::mutex::scoped_lock lock(mutex_);
+    ++stats_.defrag_steps;
+    stats_.defrag_usec += ns / 1000;
+    stats_.max_defrag_usec = std::max(stats_.max_defrag_usec, ns / 1000);
+    // writes going on at the same time can only make this look smaller than it was
+    if (after < before)
+      stats_.reclaimed_bytes += before - after;
+    return ns;
+  }
+
+  void run()
+  {
+    boost::posix_time::ptime last_sync = boost::posix_time::microsec_clock::universal_time();
+    boost::posix_time::ptime next_defrag = last_sync;
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!stop_)
+    {
+      boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+      if (sync_due(last_sync))
+      {
+        lock.unlock();
+        sync_once();
+        last_sync = boost::posix_time::microsec_clock::universal_time();
+        lock.lock();
+        continue;
+      }
+      if (now >= next_defrag)
+      {
+        lock.unlock();
+        if (defrag_due())
+        {
+          // rest in proportion to the step, so defragmenting gets defrag_budget of the time
+          double ns = double(defrag_once());
+          next_defrag = boost::posix_time::microsec_clock::universal_time()
+            + boost::posix_time::microseconds(boost::int64_t(ns * (1 - defrag_budget_) / defrag_budget_ / 1000));
+        }
+        else
+          next_defrag = now + boost::posix_time::seconds(1);
+        lock.lock();
+        continue;
+      }
+      boost::posix_time::ptime wake = next_defrag;
+      if (!sync_interval_.is_special() && sync_interval_.ticks() > 0)
+        wake = std::min(wake, last_sync + sync_interval_);
+      wake_.timed_wait(lock, wake);
+    }
+  }
+
+  void stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    if (thread_)
+    {
+      thread_->join();
+      thread_.reset();
+    }
+  }
+
+public:
+
+  maintained_hdb( hdb & h,
+                  const boost::posix_time::time_duration & sync_interval = boost::posix_time::seconds(1),
+                  boost::uint64_t sync_bytes = 64 << 20,
+                  boost::int64_t defrag_step = 256,
+                  double defrag_budget = 0.05,
+                  boost::int32_t min_free_blocks = 64 )
+  : hdb_(h), sync_interval_(sync_interval), sync_bytes_(sync_bytes), defrag_step_(defrag_step),
+    defrag_budget_(std::min(std::max(defrag_budget, 0.001), 1.0)), min_free_blocks_(min_free_blocks),
+    unsynced_(0), max_pause_ns_(0), stop_(false)
+  {
+    if (!hdb_.mutexed())
+      err::go("tokyooo: maintained_hdb needs a mutexed hdb");
+    stats s = {};
+    stats_ = s;
+    thread_.reset( new boost::thread(&maintained_hdb::run, this) );
+  }
+
+  // stops the thread, waiting for a step in progress, and syncs what's left - call close() first
+  // if you want to know whether that worked
+  ~maintained_hdb()
+  {
+    try
+    {
+      close();
+    }
+    catch (...)
+    {
+    }
+  }
+
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    result r = try_put(key, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    pause p(max_pause_ns_);
+    return hdb_.get(key, value);
+  }
+
+  template<class Key>
+  int get_into(const Key & key, void * buffer, int capacity)
+  {
+    pause p(max_pause_ns_);
+    return hdb_.get_into(key, buffer, capacity);
+  }
+
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    pause p(max_pause_ns_);
+    return hdb_.get_view(key, value);
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    pause p(max_pause_ns_);
+    return hdb_.vsize(key);
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    packed k(key), v(value);
+    pause p(max_pause_ns_);
+    result ret_val = hdb_.try_put(view(k.data(), k.size()), view(v.data(), v.size()), put_mode);
+    wrote(k.size() + v.size());
+    return ret_val;
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    packed k(key);
+    pause p(max_pause_ns_);
+    result ret_val = hdb_.try_out(view(k.data(), k.size()));
+    wrote(k.size());
+    return ret_val;
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    pause p(max_pause_ns_);
+    return hdb_.try_get(key, value);
+  }
+
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    pause p(max_pause_ns_);
+    return hdb_.try_get_view(key, value);
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    pause p(max_pause_ns_);
+    return hdb_.try_vsize(key, size);
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    packed k(key);
+    pause p(max_pause_ns_);
+    result ret_val = hdb_.try_add(view(k.data(), k.size()), value, sum);
+    wrote(k.size() + sizeof(value));
+    return ret_val;
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    packed k(key);
+    pause p(max_pause_ns_);
+    result ret_val = hdb_.try_add(view(k.data(), k.size()), value, sum);
+    wrote(k.size() + sizeof(value));
+    return ret_val;
+  }
+
+  // syncs now, on this thread
+  void sync()
+  {
+    pause p(max_pause_ns_);
+    unsynced_.store(0, boost::memory_order_relaxed);
+    hdb_.sync();
+  }
+
+  void vanish()
+  {
+    pause p(max_pause_ns_);
+    hdb_.vanish();
+  }
+
+  // stops the thread and syncs.  the hdb stays open, and calls through this carry on without upkeep
+  void close()
+  {
+    stop();
+    sync();
+  }
+
+  size_type size()
+  {
+    return hdb_.size();
+  }
+
+  size_type fsize()
+  {
+    return hdb_.fsize();
+  }
+
+  // the free blocks tchdb knows of, up to the pool's size - a rough count of the holes defrag fills
+  boost::int32_t free_blocks()
+  {
+    return hdb_.free_blocks();
+  }
+
+  stats statistics()
+  {
+    stats ret_val;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ret_val = stats_;
+    }
+    ret_val.max_pause_usec = max_pause_ns_.load(boost::memory_order_relaxed) / 1000;
+    ret_val.unsynced_bytes = unsynced_.load(boost::memory_order_relaxed);
+    ret_val.free_blocks = free_blocks();
+    ret_val.fsize = fsize();
+    return ret_val;
+  }
+
+  // starts the longest pause over, to measure one stretch of time
+  void reset_max_pause()
+  {
+    max_pause_ns_.store(0, boost::memory_order_relaxed);
+  }
+
+  hdb & backend()
+  {
+    return hdb_;
+  }
+};
+
+BOOST_CONCEPT_ASSERT((Store<maintained_hdb>));
+
+} // tokyooo
+
+#endif // __TOKYOOO_MAINTAINED_HDB_HPP__
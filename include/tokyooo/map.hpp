@@ -2,26 +2,120 @@
 #define __TOKYOOO_MAP_HPP__
 
 #include <iterator>
+#include <utility>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/type_traits/remove_const.hpp>
+#include <boost/config.hpp>
+#ifndef BOOST_NO_CXX11_HDR_UNORDERED_MAP
+#include <unordered_map>
+#endif
 #include <tcutil.h>
 #include "util.hpp"
 
 namespace tokyooo {
 
+namespace detail {
+
+// room for n more, for the containers that can make it
+template<class Container>
+void reserve(Container &, std::size_t) {}
+
+template<class T, class A>
+void reserve(std::vector<T, A> & c, std::size_t n) { c.reserve(c.size() + n); }
+
+template<class K, class T, class H, class P, class A>
+void reserve(boost::unordered_map<K, T, H, P, A> & c, std::size_t n) { c.reserve(c.size() + n); }
+
+#ifndef BOOST_NO_CXX11_HDR_UNORDERED_MAP
+template<class K, class T, class H, class P, class A>
+void reserve(std::unordered_map<K, T, H, P, A> & c, std::size_t n) { c.reserve(c.size() + n); }
+#endif
+
+} // detail
+
 class map
 {
 private:
 
   TCMAP * map_;
 
+  static TCMAP * new_map(int n) { return n > 4093 ? tcmapnew2(n) : tcmapnew(); }
+
 public:
 
   map() : map_(tcmapnew()) {}
 
   map(unsigned int bnum) : map_(tcmapnew2(bnum)) {}
 
+  // walks the records in insertion order, pointing straight into the map's storage - no copies,
+  // and no allocation.  unlike tcmapiternext it doesn't use the map's own iterator, so any number
+  // can be out at once.  anything that changes the map invalidates them
+  class const_iterator
+  {
+  private:
+
+    const TCMAPREC * rec_; // NULL at the end
+
+    tokyooo::record cur_;
+
+    void load()
+    {
+      if (rec_ == NULL)
+        return;
+      const char * k = reinterpret_cast<const char *>(rec_) + sizeof(*rec_);
+      int size = 0;
+      const void * v = tcmapiterval(k, &size);
+      cur_.key = view(k, rec_->ksiz & TCMAPKMAXSIZ);
+      cur_.value = view(v, size);
+    }
+
+  public:
+
+    typedef std::forward_iterator_tag iterator_category;
+    typedef tokyooo::record value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const tokyooo::record * pointer;
+    typedef const tokyooo::record & reference;
+
+    const_iterator() : rec_(NULL) {}
+
+    explicit const_iterator(const TCMAPREC * rec)
+    : rec_(rec)
+    {
+      load();
+    }
+
+    reference operator* () const { return cur_; }
+
+    pointer operator-> () const { return &cur_; }
+
+    const_iterator & operator++ ()
+    {
+      rec_ = rec_->next;
+      load();
+      return *this;
+    }
+
+    const_iterator operator++ (int)
+    {
+      const_iterator ret_val = *this;
+      ++*this;
+      return ret_val;
+    }
+
+    bool operator== (const const_iterator & other) const { return rec_ == other.rec_; }
+
+    bool operator!= (const const_iterator & other) const { return rec_ != other.rec_; }
+  };
+
+  typedef const_iterator iterator;
+
+  // sized up front when the iterators can tell there are more than tcmapnew's default 4093
+  // buckets would hold.  a tcmap never adds buckets later, so it never gets fewer than that
   template< class InputIterator >
   map( InputIterator begin, InputIterator end )
-  : map_(tcmapnew())
+  : map_(new_map(detail::distance(begin, end)))
   {
     put_all(begin, end);
   }
@@ -33,30 +127,35 @@ public:
 
   map & operator= (const map & other)
   {
-    tcmapdel(map_);
-    map_ = tcmapdup(other.map_);
+    TCMAP * tmp = tcmapdup(other.map_);
+    if (map_ != NULL)
+      tcmapdel(map_);
+    map_ = tmp;
     return *this;
   }
 
+  // NULL-safe, so a failed tcrdbtblget and the like can be wrapped before checking
   ~map()
   {
-    tcmapdel(map_);
+    if (map_ != NULL)
+      tcmapdel(map_);
   }
 
   template< class Key, class Value >
   void put(const Key & key, const Value & value, put_mode_e put_mode = store)
   {
+    packed k(key), v(value);
     switch (put_mode)
     {
-    case store: tcmapput(map_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)); break;
-    case keep: tcmapputkeep(map_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)); break;
-    case cat: tcmapputcat(map_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)); break;
+    case store: tcmapput(map_, k.data(), k.size(), v.data(), v.size()); break;
+    case keep: tcmapputkeep(map_, k.data(), k.size(), v.data(), v.size()); break;
+    case cat: tcmapputcat(map_, k.data(), k.size(), v.data(), v.size()); break;
     default: err::go("expardon me?"); break;
     }
   }
 
   template< class ForwardIterator >
-  void put_all(ForwardIterator begin, ForwardIterator end, put_mode_e put_mode = put)
+  void put_all(ForwardIterator begin, ForwardIterator end, put_mode_e put_mode = store)
   {
     for (; begin != end; ++begin)
       put(begin->first, begin->second, put_mode);
@@ -65,27 +164,50 @@ public:
   template<class Key>
   bool out(const Key & key)
   {
-    return tcmapout(map_, ser::cptr(key), ser::len(key));
+    packed k(key);
+    return tcmapout(map_, k.data(), k.size());
   }
 
   template<class Key, class Value>
   bool get(const Key & key, Value & value)
   {
+    packed k(key);
     int size = 0;
-    const void * p = tcmapget( map_, ser::cptr(key), ser::len(key), &size );
+    const void * p = tcmapget( map_, k.data(), k.size(), &size );
     if (p == NULL)
       return false;
-    ser::assign(value, p, size);
+    unpack(value, p, size);
     return true;
   }
 
   template<class Key>
   bool move(const Key & key, bool head)
   {
-    return tcmapmove(map_, ser::cptr(key), ser::len(key), head);
+    packed k(key);
+    return tcmapmove(map_, k.data(), k.size(), head);
   }
 
-  // TODO: iterators i guess, tcmapiterinit() and friends
+  const_iterator begin() const { return const_iterator(map_->first); }
+
+  const_iterator end() const { return const_iterator(); }
+
+  // decodes every record into out - a vector of pairs or any map-like container - reserving room
+  // for all of them first where out can
+  template<class Container>
+  void copy_to(Container & out) const
+  {
+    typedef typename Container::value_type pair_type;
+    typedef typename boost::remove_const<typename pair_type::first_type>::type key_type;
+    typedef typename pair_type::second_type value_type;
+    detail::reserve(out, size());
+    for (const_iterator it = begin(); it != end(); ++it)
+    {
+      std::pair<key_type, value_type> p;
+      unpack(p.first, it->key.data, it->key.size);
+      unpack(p.second, it->value.data, it->value.size);
+      out.insert(out.end(), p);
+    }
+  }
 
   size_type size() const
   {
@@ -105,13 +227,15 @@ public:
   template<class Key>
   int add(const Key & key, int value)
   {
-    return tcmapaddint(map_, ser::cptr(key), ser::len(key), value);
+    packed k(key);
+    return tcmapaddint(map_, k.data(), k.size(), value);
   }
 
   template<class Key>
   double add(const Key & key, double value)
   {
-    return tcmapadddouble(map_, ser::cptr(key), ser::len(key), value);
+    packed k(key);
+    return tcmapadddouble(map_, k.data(), k.size(), value);
   }
 
   void cutfront(int count)
@@ -0,0 +1,431 @@
+#ifndef __TOKYOOO_MDB_HPP__
+#define __TOKYOOO_MDB_HPP__
+
+#include <string>
+#include <limits>
+#include <malloc.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <iterator>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+
+#include <tcutil.h>
+#include "util.hpp"
+#include "stats.hpp"
+#include "store.hpp"
+
+namespace tokyooo {
+
+// the on-memory hash database: tcmdb, a hash map split into stripes with a lock each, so unlike
+// tokyooo::map one can be shared by every thread in the process.  the api is hdb's, and it's a
+// Store (see store.hpp).
+//
+// with max_records or max_bytes set, a put that goes past them cuts the oldest records with
+// tcmdbcutfront.  bytes are by msize() less what the empty mdb took, so the bucket arrays don't
+// count against them.  oldest is by when a key was first put - overwriting doesn't move it - and
+// tcmdbcutfront takes the same number from every stripe, so this is a capacity bound for a cache of
+// things that age, not an lru.  0 is no limit.  tcmdb keeps no error code, so the try_ calls report
+// a miss as not_found() and a keep on a record that's there as exists(), and nothing else can go
+// wrong.
+template<class Stats = no_stats>
+class basic_mdb : public boost::noncopyable
+{
+private:
+
+  TCMDB * mdb_;
+
+  size_type empty_msize_;   // the bucket arrays and the like, there before any record
+
+  size_type max_records_;
+
+  size_type max_bytes_;
+
+  boost::atomic<boost::uint64_t> evictions_;
+
+  Stats stats_;
+
+  result outcome(bool ok, int code, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(code);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+  // other threads are putting too, so the counts are close, not exact
+  void evict()
+  {
+    size_type before = tcmdbrnum(mdb_);
+    if (max_records_ && before > max_records_)
+      tcmdbcutfront(mdb_, before - max_records_);
+    if (max_bytes_)
+    {
+      // a percent at a time: records don't all take the same room
+      while (tcmdbmsiz(mdb_) > empty_msize_ + max_bytes_ && tcmdbrnum(mdb_) > 0)
+        tcmdbcutfront(mdb_, tcmdbrnum(mdb_) / 100 + 1);
+    }
+    size_type after = tcmdbrnum(mdb_);
+    if (after < before)
+      evictions_.fetch_add(before - after, boost::memory_order_relaxed);
+  }
+
+public:
+
+  // bnum is the bucket count, for all the stripes together.  0 is tcmdb's default
+  basic_mdb( boost::uint32_t bnum = 0, size_type max_records = 0, size_type max_bytes = 0 )
+  : mdb_(bnum ? tcmdbnew2(bnum) : tcmdbnew()), empty_msize_(tcmdbmsiz(mdb_)),
+    max_records_(max_records), max_bytes_(max_bytes), evictions_(0) {}
+
+  ~basic_mdb()
+  {
+    tcmdbdel(mdb_);
+  }
+
+  // set it before the mdb is shared between threads
+  void set_capacity(size_type max_records, size_type max_bytes = 0)
+  {
+    max_records_ = max_records;
+    max_bytes_ = max_bytes;
+  }
+
+  // store, keep or cat
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    result r = try_put(key, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    result r = try_get(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    result r = try_get_view(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    int ret_val = -1;
+    result r = try_vsize(key, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key), v(value);
+    t.add_bytes(k.size() + v.size());
+    bool ok = true;
+    switch (put_mode)
+    {
+    case store: tcmdbput(mdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case keep: ok = tcmdbputkeep(mdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case cat: tcmdbputcat(mdb_, k.data(), k.size(), v.data(), v.size()); break;
+    default: err::go("expardon me?"); break;
+    }
+    if (ok && (max_records_ || max_bytes_))
+      evict();
+    return outcome(ok, TCEKEEP, t);
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tcmdbout(mdb_, k.data(), k.size()), TCENOREC, t);
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    int size = 0;
+    void * p = tcmdbget(mdb_, k.data(), k.size(), &size);
+    if (p == NULL)
+      return outcome(false, TCENOREC, t);
+    t.add_bytes(size);
+    try
+    {
+      unpack(value, p, size);
+    }
+    catch (...)
+    {
+      std::free(p);
+      throw;
+    }
+    std::free(p);
+    return result();
+  }
+
+  // tcmdb copies the value out under the stripe's lock, and this copies it once more, into the
+  // thread's buffer
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    int size = 0;
+    void * p = tcmdbget(mdb_, k.data(), k.size(), &size);
+    if (p == NULL)
+      return outcome(false, TCENOREC, t);
+    t.add_bytes(size);
+    std::vector<char> & buffer = thread_buffer();
+    if (size > static_cast<int>(buffer.size()))
+      buffer.resize(size);
+    std::memcpy(&buffer[0], p, size);
+    std::free(p);
+    value = view(&buffer[0], size);
+    return result();
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcmdbvsiz(mdb_, k.data(), k.size());
+    if (got == -1)
+      return outcome(false, TCENOREC, t);
+    size = got;
+    return result();
+  }
+
+  // a record that's there but isn't the size of the number is exists(), as it is from tchdb
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcmdbaddint(mdb_, k.data(), k.size(), value);
+    if (got == std::numeric_limits<int>::min())
+      return outcome(false, TCEKEEP, t);
+    sum = got;
+    if (max_records_ || max_bytes_)
+      evict();
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    double got = tcmdbadddouble(mdb_, k.data(), k.size(), value);
+    if (std::isnan(got))
+      return outcome(false, TCEKEEP, t);
+    sum = got;
+    if (max_records_ || max_bytes_)
+      evict();
+    return result();
+  }
+
+  // walks every record, a stripe at a time in insertion order.  each step copies the key and then
+  // the value out, so records put or taken out by other threads during the walk may or may not be
+  // seen, and one that goes between the two copies is skipped.  like hdb's, it's a single-pass input
+  // iterator on the database's one iteration cursor: begin() again restarts every walk in progress
+  class iterator
+  {
+  private:
+
+    struct state : public boost::noncopyable
+    {
+      TCMDB * db;
+      Stats & stats;
+      void * kbuf;
+      void * vbuf;
+      tokyooo::record rec;
+
+      state(TCMDB * db, Stats & stats) : db(db), stats(stats), kbuf(NULL), vbuf(NULL) {}
+
+      ~state()
+      {
+        std::free(kbuf);
+        std::free(vbuf);
+      }
+    };
+
+    boost::shared_ptr<state> state_; // empty at the end
+
+    void next()
+    {
+      typename Stats::timer t(state_->stats, op_iterate);
+      for (;;)
+      {
+        std::free(state_->kbuf);
+        std::free(state_->vbuf);
+        state_->vbuf = NULL;
+        int ksize = 0, vsize = 0;
+        state_->kbuf = tcmdbiternext(state_->db, &ksize);
+        if (state_->kbuf == NULL)
+        {
+          state_.reset();
+          return;
+        }
+        state_->vbuf = tcmdbget(state_->db, state_->kbuf, ksize, &vsize);
+        if (state_->vbuf == NULL)
+          continue;
+        state_->rec.key = view(state_->kbuf, ksize);
+        state_->rec.value = view(state_->vbuf, vsize);
+        t.add_bytes(ksize + vsize);
+        return;
+      }
+    }
+
+  public:
+
+    typedef std::input_iterator_tag iterator_category;
+    typedef tokyooo::record value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const tokyooo::record * pointer;
+    typedef const tokyooo::record & reference;
+
+    iterator() {}
+
+    iterator(TCMDB * db, Stats & stats)
+    : state_(new state(db, stats))
+    {
+      tcmdbiterinit(db);
+      next();
+    }
+
+    reference operator* () const { return state_->rec; }
+
+    pointer operator-> () const { return &state_->rec; }
+
+    iterator & operator++ ()
+    {
+      next();
+      return *this;
+    }
+
+    bool operator== (const iterator & other) const { return state_ == other.state_; }
+
+    bool operator!= (const iterator & other) const { return state_ != other.state_; }
+  };
+
+  iterator begin()
+  {
+    return iterator(mdb_, stats_);
+  }
+
+  iterator end()
+  {
+    return iterator();
+  }
+
+  // takes out about num of the oldest records, spread over the stripes
+  void cutfront(int num)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    size_type before = tcmdbrnum(mdb_);
+    tcmdbcutfront(mdb_, num);
+    size_type after = tcmdbrnum(mdb_);
+    if (after < before)
+      evictions_.fetch_add(before - after, boost::memory_order_relaxed);
+  }
+
+  // nothing to write out - here so an mdb can stand in for an hdb
+  void sync() {}
+
+  void vanish()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcmdbvanish(mdb_);
+  }
+
+  size_type size()
+  {
+    return tcmdbrnum(mdb_);
+  }
+
+  // memory used, records and overhead
+  size_type msize()
+  {
+    return tcmdbmsiz(mdb_);
+  }
+
+  // records taken out to stay under the capacity, or by cutfront
+  boost::uint64_t evictions() const
+  {
+    return evictions_.load(boost::memory_order_relaxed);
+  }
+
+  TCMDB * native()
+  {
+    return mdb_;
+  }
+
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+};
+
+typedef basic_mdb<> mdb;
+
+BOOST_CONCEPT_ASSERT((Store<mdb>));
+
+} // tokyooo
+
+#endif // __TOKYOOO_MDB_HPP__
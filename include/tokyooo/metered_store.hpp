@@ -0,0 +1,175 @@
+#ifndef __TOKYOOO_METERED_STORE_HPP__
+#define __TOKYOOO_METERED_STORE_HPP__
+
+#include <boost/noncopyable.hpp>
+
+#include "util.hpp"
+#include "stats.hpp"
+#include "store.hpp"
+
+namespace tokyooo {
+
+// counts and times every call on a Store (see store.hpp) under Stats, the way basic_hdb<op_stats>
+// and friends do their own - for Stores that don't take a Stats policy (adb, the sharded and
+// cached adapters), or to measure a whole stack from the top.  bytes aren't counted: that would
+// mean encoding every key twice.  a failed() try_ call, or one that throws, counts as an error.
+template<class Store, class Stats = op_stats>
+class metered_store : public boost::noncopyable
+{
+private:
+
+  BOOST_CONCEPT_ASSERT((tokyooo::Store<Store>));
+
+  Store & store_;
+
+  Stats stats_;
+
+  static result outcome(const result & r, typename Stats::timer & t)
+  {
+    if (r.failed())
+      t.add_error();
+    return r;
+  }
+
+public:
+
+  explicit metered_store(Store & s)
+  : store_(s) {}
+
+  metered_store(Store & s, const Stats & stats)
+  : store_(s), stats_(stats) {}
+
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    store_.put(key, value, put_mode);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    store_.out(key);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    return store_.get(key, value);
+  }
+
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    return store_.get_view(key, value);
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    return store_.vsize(key);
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    typename Stats::timer t(stats_, op_add);
+    return store_.add(key, value);
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    typename Stats::timer t(stats_, op_add);
+    return store_.add(key, value);
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    return outcome(store_.try_put(key, value, put_mode), t);
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    return outcome(store_.try_out(key), t);
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    return outcome(store_.try_get(key, value), t);
+  }
+
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    return outcome(store_.try_get_view(key, value), t);
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    return outcome(store_.try_vsize(key, size), t);
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    return outcome(store_.try_add(key, value, sum), t);
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    return outcome(store_.try_add(key, value, sum), t);
+  }
+
+  void sync()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    store_.sync();
+  }
+
+  void vanish()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    store_.vanish();
+  }
+
+  size_type size()
+  {
+    return store_.size();
+  }
+
+  Store & backend()
+  {
+    return store_;
+  }
+
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_METERED_STORE_HPP__
@@ -0,0 +1,269 @@
+#ifndef __TOKYOOO_MULTI_QUERY_HPP__
+#define __TOKYOOO_MULTI_QUERY_HPP__
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/noncopyable.hpp>
+
+#include <tcutil.h>
+#include "util.hpp"
+#include "list.hpp"
+#include "rdb.hpp"
+#include "query.hpp"
+#include "sharded_rdb.hpp"
+#include "parallel.hpp"
+
+namespace tokyooo {
+
+// the same table query run against several servers at once, with the results put back together as
+// if they'd come from one: merged on the order column, then skip and limit applied to the whole.
+// each server is only asked for limit + skip rows, since that's the most the merge can use, and
+// the merge stops as soon as it has limit of them.
+class multi_query : public boost::noncopyable
+{
+private:
+
+  struct condition
+  {
+    std::string name;
+    query::op_e op;
+    std::string expr;
+  };
+
+  // one server's results, read from the front during the merge
+  struct cursor
+  {
+    list rows;
+    int pos;
+    view value;   // of the order column, in rows[pos]
+    double number;
+  };
+
+  struct search_job
+  {
+    multi_query & q;
+    std::vector<cursor> & results;
+    bool rows;
+
+    void operator() (std::size_t i)
+    {
+      query qry(*q.shards_[i]);
+      for (std::vector<condition>::const_iterator it = q.conds_.begin(); it != q.conds_.end(); ++it)
+        qry.cond(it->name, it->op, it->expr);
+      if (q.ordered_)
+        qry.order(q.order_name_, q.order_type_);
+      if (q.max_ >= 0)
+        qry.limit(q.max_ + q.skip_, 0);
+      if (rows)
+        qry.search_rows(results[i].rows);
+      else
+        qry.search_keys(results[i].rows);
+    }
+  };
+
+  struct count_job
+  {
+    multi_query & q;
+    std::vector<int> & counts;
+
+    void operator() (std::size_t i)
+    {
+      query qry(*q.shards_[i]);
+      for (std::vector<condition>::const_iterator it = q.conds_.begin(); it != q.conds_.end(); ++it)
+        qry.cond(it->name, it->op, it->expr);
+      counts[i] = qry.count();
+    }
+  };
+
+  // priority_queue keeps the largest on top, so this says a goes after b
+  struct later
+  {
+    const std::vector<cursor> & results;
+    query::order_e type;
+
+    bool operator() (std::size_t a, std::size_t b) const
+    {
+      const cursor & x = results[a];
+      const cursor & y = results[b];
+      int c = 0;
+      if (type == query::num_asc || type == query::num_desc)
+        c = x.number < y.number ? -1 : (y.number < x.number ? 1 : 0);
+      else
+      {
+        c = std::memcmp(x.value.data, y.value.data, std::min(x.value.size, y.value.size));
+        if (c == 0)
+          c = x.value.size - y.value.size;
+      }
+      if (type == query::str_desc || type == query::num_desc)
+        c = -c;
+      return c == 0 ? a > b : c > 0;
+    }
+  };
+
+  std::vector<rdb *> shards_;
+
+  std::vector<condition> conds_;
+
+  bool ordered_;
+
+  std::string order_name_;
+
+  query::order_e order_type_;
+
+  int max_;
+
+  int skip_;
+
+  // points c at its next row, or returns false if it's run out
+  bool load(cursor & c)
+  {
+    int size = 0;
+    const char * p = reinterpret_cast<const char *>(tclistval(c.rows.native(), c.pos, &size));
+    if (p == NULL)
+      return false;
+    c.value = query::column(p, size, order_name_);
+    c.number = std::strtod(c.value.data, NULL);
+    return true;
+  }
+
+  // keys are the "" column of each row
+  static void push(list & out, const char * p, int size, bool keys_only)
+  {
+    if (keys_only)
+    {
+      view k = query::column(p, size, "");
+      tclistpush(out.native(), k.data, k.size);
+    }
+    else
+      tclistpush(out.native(), p, size);
+  }
+
+  void merge(std::vector<cursor> & results, list & out, bool keys_only)
+  {
+    list merged;
+    int skip = skip_;
+    int left = max_ < 0 ? -1 : max_;
+    if (!ordered_)
+    {
+      for (std::size_t i = 0; i < results.size() && left != 0; ++i)
+      {
+        for (int j = 0; j < static_cast<int>(results[i].rows.size()) && left != 0; ++j)
+        {
+          if (skip > 0)
+          {
+            --skip;
+            continue;
+          }
+          int size = 0;
+          const void * p = tclistval(results[i].rows.native(), j, &size);
+          tclistpush(merged.native(), p, size);
+          --left;
+        }
+      }
+      out.swap(merged);
+      return;
+    }
+    later cmp = { results, order_type_ };
+    std::priority_queue< std::size_t, std::vector<std::size_t>, later > heads(cmp);
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+      results[i].pos = 0;
+      if (load(results[i]))
+        heads.push(i);
+    }
+    while (!heads.empty() && left != 0)
+    {
+      std::size_t i = heads.top();
+      heads.pop();
+      cursor & c = results[i];
+      if (skip > 0)
+        --skip;
+      else
+      {
+        int size = 0;
+        const char * p = reinterpret_cast<const char *>(tclistval(c.rows.native(), c.pos, &size));
+        push(merged, p, size, keys_only);
+        --left;
+      }
+      ++c.pos;
+      if (load(c))
+        heads.push(i);
+    }
+    out.swap(merged);
+  }
+
+  void search(list & out, bool keys_only)
+  {
+    std::vector<cursor> results(shards_.size());
+    // merging keys on a column needs the column, so ordered key searches fetch rows
+    search_job job = { *this, results, !keys_only || ordered_ };
+    parallel_for(shards_.size(), job);
+    merge(results, out, keys_only && ordered_);
+  }
+
+public:
+
+  multi_query(const std::vector<rdb *> & shards)
+  : shards_(shards), ordered_(false), order_type_(query::str_asc), max_(-1), skip_(0) {}
+
+  multi_query(sharded_rdb & shards)
+  : ordered_(false), order_type_(query::str_asc), max_(-1), skip_(0)
+  {
+    shards.shards(shards_);
+  }
+
+  multi_query & cond(const std::string & name, query::op_e op, const std::string & expr)
+  {
+    condition c = { name, op, expr };
+    conds_.push_back(c);
+    return *this;
+  }
+
+  multi_query & order(const std::string & name, query::order_e order)
+  {
+    ordered_ = true;
+    order_name_ = name;
+    order_type_ = order;
+    return *this;
+  }
+
+  // max < 0 means no limit
+  multi_query & limit(int max, int skip)
+  {
+    max_ = max;
+    skip_ = skip < 0 ? 0 : skip;
+    return *this;
+  }
+
+  void search_keys( list & keys )
+  {
+    search(keys, true);
+  }
+
+  // rows in the same zero separated format as query::search_rows - use query::row() to read them
+  void search_rows( list & rows )
+  {
+    search(rows, false);
+  }
+
+  // matches on every server put together.  limit doesn't apply
+  int count()
+  {
+    std::vector<int> counts(shards_.size());
+    count_job job = { *this, counts };
+    parallel_for(shards_.size(), job);
+    int ret_val = 0;
+    for (std::size_t i = 0; i < counts.size(); ++i)
+      ret_val += counts[i];
+    return ret_val;
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_MULTI_QUERY_HPP__
@@ -0,0 +1,447 @@
+#ifndef __TOKYOOO_NDB_HPP__
+#define __TOKYOOO_NDB_HPP__
+
+#include <string>
+#include <limits>
+#include <malloc.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <iterator>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+
+#include <tcutil.h>
+#include "util.hpp"
+#include "stats.hpp"
+#include "store.hpp"
+#include "order.hpp"
+
+namespace tokyooo {
+
+// the on-memory tree database: tcndb, a splay tree behind one lock, with keys in Order (see
+// order.hpp).  like mdb it can be shared by every thread in the process, and has hdb's api plus
+// walks in key order from any key.  it's a Store (see store.hpp).  every call, reads included,
+// reshapes the tree under that one lock, so where order doesn't matter mdb scales better.
+//
+// with max_records or max_bytes set, a put that goes past them cuts records from the fringe of the
+// tree with tcndbcutfringe - the ones a splay tree has pushed furthest from the root, which are the
+// ones touched least lately.  bytes are by msize() less what the empty ndb took.  0 is no limit.
+// tcndb keeps no error code, so the try_ calls report a miss as not_found() and a keep on a record
+// that's there as exists(), and nothing else can go wrong.
+template<class Order = lexical_order, class Stats = no_stats>
+class basic_ndb : public boost::noncopyable
+{
+private:
+
+  TCNDB * ndb_;
+
+  size_type empty_msize_;   // the tree's own overhead, there before any record
+
+  size_type max_records_;
+
+  size_type max_bytes_;
+
+  boost::atomic<boost::uint64_t> evictions_;
+
+  Stats stats_;
+
+  result outcome(bool ok, int code, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(code);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+  // other threads are putting too, so the counts are close, not exact
+  void evict()
+  {
+    size_type before = tcndbrnum(ndb_);
+    if (max_records_ && before > max_records_)
+      tcndbcutfringe(ndb_, before - max_records_);
+    if (max_bytes_)
+    {
+      // a percent at a time: records don't all take the same room
+      while (tcndbmsiz(ndb_) > empty_msize_ + max_bytes_ && tcndbrnum(ndb_) > 0)
+        tcndbcutfringe(ndb_, tcndbrnum(ndb_) / 100 + 1);
+    }
+    size_type after = tcndbrnum(ndb_);
+    if (after < before)
+      evictions_.fetch_add(before - after, boost::memory_order_relaxed);
+  }
+
+public:
+
+  basic_ndb( size_type max_records = 0, size_type max_bytes = 0 )
+  : ndb_(tcndbnew2(Order::function(), NULL)), empty_msize_(tcndbmsiz(ndb_)),
+    max_records_(max_records), max_bytes_(max_bytes), evictions_(0) {}
+
+  ~basic_ndb()
+  {
+    tcndbdel(ndb_);
+  }
+
+  // set it before the ndb is shared between threads
+  void set_capacity(size_type max_records, size_type max_bytes = 0)
+  {
+    max_records_ = max_records;
+    max_bytes_ = max_bytes;
+  }
+
+  // store, keep or cat
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    result r = try_put(key, value, put_mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    result r = try_get(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    result r = try_get_view(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    int ret_val = -1;
+    result r = try_vsize(key, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
+    return ret_val;
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key), v(value);
+    t.add_bytes(k.size() + v.size());
+    bool ok = true;
+    switch (put_mode)
+    {
+    case store: tcndbput(ndb_, k.data(), k.size(), v.data(), v.size()); break;
+    case keep: ok = tcndbputkeep(ndb_, k.data(), k.size(), v.data(), v.size()); break;
+    case cat: tcndbputcat(ndb_, k.data(), k.size(), v.data(), v.size()); break;
+    default: err::go("expardon me?"); break;
+    }
+    if (ok && (max_records_ || max_bytes_))
+      evict();
+    return outcome(ok, TCEKEEP, t);
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tcndbout(ndb_, k.data(), k.size()), TCENOREC, t);
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    int size = 0;
+    void * p = tcndbget(ndb_, k.data(), k.size(), &size);
+    if (p == NULL)
+      return outcome(false, TCENOREC, t);
+    t.add_bytes(size);
+    try
+    {
+      unpack(value, p, size);
+    }
+    catch (...)
+    {
+      std::free(p);
+      throw;
+    }
+    std::free(p);
+    return result();
+  }
+
+  // tcndb copies the value out under its lock, and this copies it once more, into the thread's
+  // buffer
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    int size = 0;
+    void * p = tcndbget(ndb_, k.data(), k.size(), &size);
+    if (p == NULL)
+      return outcome(false, TCENOREC, t);
+    t.add_bytes(size);
+    std::vector<char> & buffer = thread_buffer();
+    if (size > static_cast<int>(buffer.size()))
+      buffer.resize(size);
+    std::memcpy(&buffer[0], p, size);
+    std::free(p);
+    value = view(&buffer[0], size);
+    return result();
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcndbvsiz(ndb_, k.data(), k.size());
+    if (got == -1)
+      return outcome(false, TCENOREC, t);
+    size = got;
+    return result();
+  }
+
+  // a record that's there but isn't the size of the number is exists(), as it is from tchdb
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcndbaddint(ndb_, k.data(), k.size(), value);
+    if (got == std::numeric_limits<int>::min())
+      return outcome(false, TCEKEEP, t);
+    sum = got;
+    if (max_records_ || max_bytes_)
+      evict();
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    double got = tcndbadddouble(ndb_, k.data(), k.size(), value);
+    if (std::isnan(got))
+      return outcome(false, TCEKEEP, t);
+    sum = got;
+    if (max_records_ || max_bytes_)
+      evict();
+    return result();
+  }
+
+  // walks the records in key order.  each step copies the key and then the value out, so records
+  // put or taken out by other threads during the walk may or may not be seen, and one that goes
+  // between the two copies is skipped.  like hdb's, it's a single-pass input iterator on the
+  // database's one iteration cursor: begin() or from() again restarts every walk in progress
+  class iterator
+  {
+  private:
+
+    struct state : public boost::noncopyable
+    {
+      TCNDB * db;
+      Stats & stats;
+      void * kbuf;
+      void * vbuf;
+      tokyooo::record rec;
+
+      state(TCNDB * db, Stats & stats) : db(db), stats(stats), kbuf(NULL), vbuf(NULL) {}
+
+      ~state()
+      {
+        std::free(kbuf);
+        std::free(vbuf);
+      }
+    };
+
+    boost::shared_ptr<state> state_; // empty at the end
+
+    void next()
+    {
+      typename Stats::timer t(state_->stats, op_iterate);
+      for (;;)
+      {
+        std::free(state_->kbuf);
+        std::free(state_->vbuf);
+        state_->vbuf = NULL;
+        int ksize = 0, vsize = 0;
+        state_->kbuf = tcndbiternext(state_->db, &ksize);
+        if (state_->kbuf == NULL)
+        {
+          state_.reset();
+          return;
+        }
+        state_->vbuf = tcndbget(state_->db, state_->kbuf, ksize, &vsize);
+        if (state_->vbuf == NULL)
+          continue;
+        state_->rec.key = view(state_->kbuf, ksize);
+        state_->rec.value = view(state_->vbuf, vsize);
+        t.add_bytes(ksize + vsize);
+        return;
+      }
+    }
+
+  public:
+
+    typedef std::input_iterator_tag iterator_category;
+    typedef tokyooo::record value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const tokyooo::record * pointer;
+    typedef const tokyooo::record & reference;
+
+    iterator() {}
+
+    iterator(TCNDB * db, Stats & stats)
+    : state_(new state(db, stats))
+    {
+      tcndbiterinit(db);
+      next();
+    }
+
+    // from the first key not before start
+    iterator(TCNDB * db, Stats & stats, const packed & start)
+    : state_(new state(db, stats))
+    {
+      tcndbiterinit2(db, start.data(), start.size());
+      next();
+    }
+
+    reference operator* () const { return state_->rec; }
+
+    pointer operator-> () const { return &state_->rec; }
+
+    iterator & operator++ ()
+    {
+      next();
+      return *this;
+    }
+
+    bool operator== (const iterator & other) const { return state_ == other.state_; }
+
+    bool operator!= (const iterator & other) const { return state_ != other.state_; }
+  };
+
+  iterator begin()
+  {
+    return iterator(ndb_, stats_);
+  }
+
+  template<class Key>
+  iterator from(const Key & start)
+  {
+    return iterator(ndb_, stats_, packed(start));
+  }
+
+  iterator end()
+  {
+    return iterator();
+  }
+
+  // takes out num records from the fringe of the tree
+  void cutfringe(int num)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    size_type before = tcndbrnum(ndb_);
+    tcndbcutfringe(ndb_, num);
+    size_type after = tcndbrnum(ndb_);
+    if (after < before)
+      evictions_.fetch_add(before - after, boost::memory_order_relaxed);
+  }
+
+  // nothing to write out - here so an ndb can stand in for a bdb
+  void sync() {}
+
+  void vanish()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tcndbvanish(ndb_);
+  }
+
+  size_type size()
+  {
+    return tcndbrnum(ndb_);
+  }
+
+  // memory used, records and overhead
+  size_type msize()
+  {
+    return tcndbmsiz(ndb_);
+  }
+
+  // records taken out to stay under the capacity, or by cutfringe
+  boost::uint64_t evictions() const
+  {
+    return evictions_.load(boost::memory_order_relaxed);
+  }
+
+  TCNDB * native()
+  {
+    return ndb_;
+  }
+
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+};
+
+template<class Order, class Stats>
+struct supports_ordered_scan< basic_ndb<Order, Stats> > : boost::true_type {};
+
+typedef basic_ndb<> ndb;
+
+BOOST_CONCEPT_ASSERT((Store<ndb>));
+
+} // tokyooo
+
+#endif // __TOKYOOO_NDB_HPP__
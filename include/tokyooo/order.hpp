@@ -0,0 +1,34 @@
+#ifndef __TOKYOOO_ORDER_HPP__
+#define __TOKYOOO_ORDER_HPP__
+
+#include <tcutil.h>
+
+namespace tokyooo {
+
+// how a bdb or an ndb orders its keys, picked at compile time.  the keys have to be encoded to suit:
+// int32 wants 4 byte keys (int), int64 8 byte ones (boost::int64_t), decimal numbers written out as
+// text.  ints compared with lexical come out in byte order, which isn't numeric order on this end
+// of town
+struct lexical_order
+{
+  static TCCMP function() { return tccmplexical; }
+};
+
+struct decimal_order
+{
+  static TCCMP function() { return tccmpdecimal; }
+};
+
+struct int32_order
+{
+  static TCCMP function() { return tccmpint32; }
+};
+
+struct int64_order
+{
+  static TCCMP function() { return tccmpint64; }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_ORDER_HPP__
@@ -0,0 +1,71 @@
+#ifndef __TOKYOOO_PARALLEL_HPP__
+#define __TOKYOOO_PARALLEL_HPP__
+
+#include <string>
+#include <exception>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "util.hpp"
+
+namespace tokyooo {
+
+namespace detail {
+
+template<class F>
+struct parallel_job
+{
+  F & f;
+  std::size_t i;
+  std::string & error;
+  boost::mutex & mutex;
+
+  void operator() ()
+  {
+    try
+    {
+      f(i);
+    }
+    catch (std::exception & e)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      if (error.empty())
+        error = e.what();
+    }
+  }
+};
+
+} // detail
+
+// calls f(0) ... f(n - 1) at the same time, one thread each (f(0) gets the calling thread), and
+// waits for all of them.  every thread calls the same f, so it has to be fine with that.  if any
+// of them throw, the first error is rethrown here once they're all done
+template<class F>
+void parallel_for(std::size_t n, F f)
+{
+  if (n == 0)
+    return;
+  if (n == 1)
+  {
+    f(0);
+    return;
+  }
+  std::string error;
+  boost::mutex mutex;
+  boost::thread_group threads;
+  for (std::size_t i = 1; i < n; ++i)
+  {
+    detail::parallel_job<F> job = { f, i, error, mutex };
+    threads.create_thread(job);
+  }
+  detail::parallel_job<F> job = { f, 0, error, mutex };
+  job();
+  threads.join_all();
+  if (!error.empty())
+    err::go(error);
+}
+
+} // tokyooo
+
+#endif // __TOKYOOO_PARALLEL_HPP__
@@ -1,24 +1,32 @@
 #ifndef __TOKYOOO_QUERY_HPP__
 #define __TOKYOOO_QUERY_HPP__
 
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <cstring>
+
 #include <tcrdb.h>
+#include <tctdb.h>
+#include "util.hpp"
 #include "rdb.hpp"
+#include "tdb.hpp"
 #include "list.hpp"
+#include "map.hpp"
+#include "stats.hpp"
 
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 namespace tokyooo {
 
-class query : public boost::noncopyable
+// the operators, outside the template so every basic_query shares them
+struct query_base
 {
-private:
-
-  TCRDB * rdb_;
-
-  RDBQRY * qry_;
-
-public:
-
   enum op_e
   {
     str_equal = RDBQCSTREQ,         /* string is equal to */
@@ -52,62 +60,562 @@ public:
     num_desc = RDBQONUMDESC         /* number descending */
   };
 
-  query( rdb & rdb ) : rdb_(rdb.native()), qry_( tcrdbqrynew(rdb_) ) {}
+  enum meta_e
+  {
+    meta_union = RDBMSUNION,        /* keys matched by any of the queries */
+    meta_intersect = RDBMSISECT,    /* keys matched by all of them */
+    meta_diff = RDBMSDIFF           /* keys matched by the first and none of the rest */
+  };
+};
+
+// where a query runs: these are the only calls basic_query and its cursor make.  tctdb numbers its
+// operators, orders and meta types the same as tcrdb, so query_base serves both
+
+// against a table database in ttserver, through an rdb
+struct remote_table
+{
+  typedef TCRDB db_type;
+
+  typedef RDBQRY query_type;
+
+  static query_type * create(db_type * db) { return tcrdbqrynew(db); }
+
+  static void destroy(query_type * q) { tcrdbqrydel(q); }
+
+  static void add_cond(query_type * q, const char * name, int op, const char * expr) { tcrdbqryaddcond(q, name, op, expr); }
+
+  static void set_order(query_type * q, const char * name, int type) { tcrdbqrysetorder(q, name, type); }
+
+  static void set_limit(query_type * q, int max, int skip) { tcrdbqrysetlimit(q, max, skip); }
+
+  static TCLIST * search(query_type * q) { return tcrdbqrysearch(q); }
+
+  static TCLIST * search_rows(db_type *, query_type * q) { return tcrdbqrysearchget(q); }
 
-  ~query()
+  static bool search_out(query_type * q) { return tcrdbqrysearchout(q); }
+
+  static int count(query_type * q) { return tcrdbqrysearchcount(q); }
+
+  static const char * hint(query_type * q) { return tcrdbqryhint(q); }
+
+  static TCLIST * metasearch(query_type ** qs, int num, int type) { return tcrdbmetasearch(qs, num, type); }
+};
+
+// against a tdb in this process
+struct local_table
+{
+  typedef TCTDB db_type;
+
+  typedef TDBQRY query_type;
+
+  static query_type * create(db_type * db) { return tctdbqrynew(db); }
+
+  static void destroy(query_type * q) { tctdbqrydel(q); }
+
+  static void add_cond(query_type * q, const char * name, int op, const char * expr) { tctdbqryaddcond(q, name, op, expr); }
+
+  static void set_order(query_type * q, const char * name, int type) { tctdbqrysetorder(q, name, type); }
+
+  static void set_limit(query_type * q, int max, int skip) { tctdbqrysetlimit(q, max, skip); }
+
+  static TCLIST * search(query_type * q) { return tctdbqrysearch(q); }
+
+  // tctdb only finds keys, so each row is read here and joined into the same zero separated form
+  // tcrdbqrysearchget hands back, primary key under ""
+  static TCLIST * search_rows(db_type * db, query_type * q)
   {
-    tcrdbqrydel( qry_ );
+    TCLIST * keys = tctdbqrysearch(q);
+    if (keys == NULL)
+      return NULL;
+    int num = tclistnum(keys);
+    TCLIST * ret_val = tclistnew2(num);
+    for (int i = 0; i < num; ++i)
+    {
+      int ksize = 0;
+      const void * k = tclistval(keys, i, &ksize);
+      TCMAP * cols = tctdbget(db, k, ksize);
+      // gone since the search, if something else is writing
+      if (cols == NULL)
+        continue;
+      tcmapput(cols, "", 0, k, ksize);
+      int size = 0;
+      char * row = tcstrjoin4(cols, &size);
+      tclistpushmalloc(ret_val, row, size);
+      tcmapdel(cols);
+    }
+    tclistdel(keys);
+    return ret_val;
   }
 
-  query & cond(const std::string & name, op_e op, const std::string expr)
+  static bool search_out(query_type * q) { return tctdbqrysearchout(q); }
+
+  // there's no count call in tctdb, so it's the keys, counted
+  static int count(query_type * q)
   {
-    tcrdbqryaddcond(qry_, name.c_str(), op, expr.c_str());
+    TCLIST * keys = tctdbqrysearch(q);
+    if (keys == NULL)
+      return -1;
+    int ret_val = tclistnum(keys);
+    tclistdel(keys);
+    return ret_val;
+  }
+
+  static const char * hint(query_type * q) { return tctdbqryhint(q); }
+
+  static TCLIST * metasearch(query_type ** qs, int num, int type) { return tctdbmetasearch(qs, num, type); }
+};
+
+// the same query against ttserver (basic_query<Stats>, on an rdb) or in process (basic_query<Stats,
+// local_table>, on a tdb).  searches, counts and the cursor's fetches are recorded as op_search
+// under Stats
+template<class Stats = no_stats, class Table = remote_table>
+class basic_query : public query_base, public boost::noncopyable
+{
+public:
+
+  class cursor;
+
+private:
+
+  struct condition
+  {
+    std::string name;
+    int op;
+    std::string expr;
+  };
+
+  typename Table::db_type * db_;
+
+  typename Table::query_type * qry_;
+
+  Stats stats_;
+
+  // what's been set on qry_, so a cursor can build its own queries from it
+  std::vector<condition> conds_;
+
+  std::string order_name_;
+
+  int order_type_;
+
+  int max_;
+
+  int skip_;
+
+  result outcome(bool ok, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(db_);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+public:
+
+  // an rdb for remote_table, a tdb for local_table.  counts into its stats if they're the same kind
+  template<template<class> class Db>
+  basic_query( Db<Stats> & db )
+  : db_(db.native()), qry_( Table::create(db_) ), stats_(db.stats()), order_type_(str_asc), max_(-1), skip_(0) {}
+
+  template<class Db>
+  basic_query( Db & db )
+  : db_(db.native()), qry_( Table::create(db_) ), order_type_(str_asc), max_(-1), skip_(0) {}
+
+  ~basic_query()
+  {
+    Table::destroy( qry_ );
+  }
+
+  basic_query & cond(const std::string & name, op_e op, const std::string expr)
+  {
+    Table::add_cond(qry_, name.c_str(), op, expr.c_str());
+    condition c = { name, op, expr };
+    conds_.push_back(c);
     return *this;
   }
 
-  query & order(const std::string & name, order_e order)
+  basic_query & order(const std::string & name, order_e order)
   {
-    tcrdbqrysetorder(qry_, name.c_str(), order);
+    Table::set_order(qry_, name.c_str(), order);
+    order_name_ = name;
+    order_type_ = order;
     return * this;
   }
 
-  query & limit(int max, int skip)
+  basic_query & limit(int max, int skip)
   {
-    tcrdbqrysetlimit(qry_, max, skip);
+    Table::set_limit(qry_, max, skip);
+    max_ = max;
+    skip_ = skip < 0 ? 0 : skip;
     return *this;
   }
 
   void search_keys( list & keys )
   {
-    list tmp( tcrdbqrysearch(qry_) );
-    tmp.native() || err::go(rdb_);
-    keys.swap(tmp);
+    result r = try_search_keys(keys);
+    r.ok() || err::go(r);
   }
 
   void search_rows( list & rows )
   {
-    list tmp( tcrdbqrysearchget(qry_) );
-    tmp.native() || err::go(rdb_);
+    result r = try_search_rows(rows);
+    r.ok() || err::go(r);
+  }
+
+  // search_keys and search_rows without the exceptions.  finding nothing is ok(), with an empty list
+  result try_search_keys( list & keys )
+  {
+    typename Stats::timer t(stats_, op_search);
+    list tmp( Table::search(qry_) );
+    if (!tmp.native())
+      return outcome(false, t);
+    keys.swap(tmp);
+    return result();
+  }
+
+  result try_search_rows( list & rows )
+  {
+    typename Stats::timer t(stats_, op_search);
+    list tmp( Table::search_rows(db_, qry_) );
+    if (!tmp.native())
+      return outcome(false, t);
     rows.swap(tmp);
+    return result();
+  }
+
+  list search_keys()
+  {
+    typename Stats::timer t(stats_, op_search);
+    list ret_val( Table::search(qry_) );
+    ret_val.native() || err::go(db_);
+    return ret_val;
+  }
+
+  list search_rows()
+  {
+    typename Stats::timer t(stats_, op_search);
+    list ret_val( Table::search_rows(db_, qry_) );
+    ret_val.native() || err::go(db_);
+    return ret_val;
+  }
+
+  // runs this query and others against the same database in one go, and combines their keys
+  void metasearch(const std::vector<basic_query *> & others, meta_e type, list & keys)
+  {
+    typename Stats::timer t(stats_, op_search);
+    std::vector<typename Table::query_type *> qrys(1, qry_);
+    for (typename std::vector<basic_query *>::const_iterator it = others.begin(); it != others.end(); ++it)
+      qrys.push_back((*it)->qry_);
+    list tmp( Table::metasearch(&qrys[0], qrys.size(), type) );
+    tmp.native() || err::go(db_);
+    keys.swap(tmp);
+  }
+
+  // the columns of row index of a search_rows result.  the primary key is the column named ""
+  static bool row(list & rows, int index, map & columns)
+  {
+    if (index < 0 || index >= static_cast<int>(rows.size()))
+      return false;
+    int size = 0;
+    const void * p = tclistval(rows.native(), index, &size);
+    map tmp( tcstrsplit4(p, size) );
+    columns.swap(tmp);
+    return true;
+  }
+
+  // the value of column name in one row of a search_rows result, without building a map.  tclist
+  // values are nul terminated, so data can go straight to strtod
+  static view column(const void * row, int size, const std::string & name)
+  {
+    const char * p = static_cast<const char *>(row);
+    const char * end = p + size;
+    while (p < end)
+    {
+      const char * n = p;
+      p += std::strlen(p) + 1;
+      if (p > end)
+        break;
+      const char * v = p;
+      p += std::strlen(p) + 1;
+      if (static_cast<std::size_t>(v - n - 1) == name.size() && std::memcmp(n, name.data(), name.size()) == 0)
+        return view(v, std::strlen(v));
+    }
+    return view("", 0);
   }
 
   void out()
   {
-    tcrdbqrysearchout(qry_) || err::go(rdb_);
+    result r = try_out();
+    r.ok() || err::go(r);
+  }
+
+  result try_out()
+  {
+    typename Stats::timer t(stats_, op_search);
+    return outcome(Table::search_out(qry_), t);
   }
 
   int count()
   {
-    return tcrdbqrysearchcount(qry_);
+    typename Stats::timer t(stats_, op_search);
+    return Table::count(qry_);
   }
 
   std::string hint()
   {
-    const char * ret_val = tcrdbqryhint(qry_);
+    const char * ret_val = Table::hint(qry_);
     return std::string(ret_val);
   }
 };
 
+// walks the results of a query a page at a time instead of pulling them all into one list.  the
+// next page is fetched on a background thread while the current one is read, so at most three pages
+// are held at once: the one being read, one ready after it, and one being fetched.  pages come
+// either from limit/skip on the query, or - if the query is ordered on a numeric column whose
+// values are unique - by asking for rows past the last value seen, which doesn't get slower the
+// further in you go and doesn't skip or repeat rows if others are added.  the query's own limit
+// and skip still apply to the whole walk.
+//
+//   query::cursor c(q, 1000);
+//   map row;
+//   while (c.next_row(row))
+//     ...
+//
+// the cursor takes a copy of the query's conditions, so the query can go away first, but the
+// database can't.  tcrdb locks around each call, so the rdb can still be used while the cursor is
+// fetching; a tdb has to be mutexed for that.
+template<class Stats, class Table>
+class basic_query<Stats, Table>::cursor : public boost::noncopyable
+{
+public:
+
+  enum fetch_e
+  {
+    rows,
+    keys
+  };
+
+  enum paging_e
+  {
+    by_skip,
+    by_order
+  };
+
+private:
+
+  typename Table::db_type * db_;
+
+  Stats stats_;
+
+  std::vector<condition> conds_;
+
+  std::string order_name_;
+
+  int order_type_;
+
+  int max_;
+
+  int skip_;
+
+  int page_size_;
+
+  fetch_e fetch_;
+
+  paging_e paging_;
+
+  // read by the caller
+  list current_;
+
+  int pos_;
+
+  // shared with the fetcher
+  boost::mutex mutex_;
+
+  boost::condition_variable changed_;
+
+  list ready_;
+
+  bool has_ready_;
+
+  bool done_;
+
+  bool stop_;
+
+  std::string error_;
+
+  // fetcher only
+  int fetched_;
+
+  std::string last_;
+
+  boost::scoped_ptr<boost::thread> thread_;
+
+  // rows are needed to read the order column, even if the caller only wants keys
+  bool fetch_rows() const
+  {
+    return fetch_ == rows || paging_ == by_order;
+  }
+
+  void fetch(list & page, int max)
+  {
+    typename Stats::timer t(stats_, op_search);
+    typename Table::query_type * qry = Table::create(db_);
+    for (typename std::vector<condition>::const_iterator it = conds_.begin(); it != conds_.end(); ++it)
+      Table::add_cond(qry, it->name.c_str(), it->op, it->expr.c_str());
+    if (!order_name_.empty())
+      Table::set_order(qry, order_name_.c_str(), order_type_);
+    int skip = skip_ + fetched_;
+    if (paging_ == by_order && fetched_ > 0)
+    {
+      Table::add_cond(qry, order_name_.c_str(), order_type_ == num_asc ? num_greater : num_less, last_.c_str());
+      skip = 0;
+    }
+    Table::set_limit(qry, max, skip);
+    list tmp( fetch_rows() ? Table::search_rows(db_, qry) : Table::search(qry) );
+    Table::destroy(qry);
+    tmp.native() || err::go(db_);
+    page.swap(tmp);
+  }
+
+  void run()
+  {
+    for (;;)
+    {
+      list page;
+      int max = max_ < 0 ? page_size_ : std::min(page_size_, max_ - fetched_);
+      bool last = max <= 0;
+      try
+      {
+        if (!last)
+          fetch(page, max);
+      }
+      catch (std::exception & e)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        error_ = e.what();
+        done_ = true;
+        changed_.notify_all();
+        return;
+      }
+      int num = page.size();
+      fetched_ += num;
+      last = last || num < max;
+      if (paging_ == by_order && num > 0)
+      {
+        int size = 0;
+        const void * p = tclistval(page.native(), num - 1, &size);
+        last_ = column(p, size, order_name_).str();
+      }
+      boost::mutex::scoped_lock lock(mutex_);
+      while (has_ready_ && !stop_)
+        changed_.wait(lock);
+      if (stop_)
+        return;
+      ready_.swap(page);
+      has_ready_ = true;
+      done_ = last;
+      changed_.notify_all();
+      if (last)
+        return;
+    }
+  }
+
+  // moves on to the next page, waiting for it if it isn't here yet
+  bool advance()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!has_ready_ && !done_)
+      changed_.wait(lock);
+    if (!has_ready_)
+    {
+      if (!error_.empty())
+        err::go(error_);
+      return false;
+    }
+    current_.swap(ready_);
+    has_ready_ = false;
+    pos_ = 0;
+    changed_.notify_all();
+    return true;
+  }
+
+  // the next result, or NULL at the end
+  const void * next(int & size)
+  {
+    while (pos_ >= static_cast<int>(current_.size()))
+    {
+      if (!advance())
+        return NULL;
+    }
+    return tclistval(current_.native(), pos_++, &size);
+  }
+
+public:
+
+  // by_order needs the query ordered on a numeric column with no duplicates.  anything else falls
+  // back to by_skip
+  cursor(basic_query & q, int page_size, fetch_e fetch = rows, paging_e paging = by_skip)
+  : db_(q.db_), stats_(q.stats_), conds_(q.conds_), order_name_(q.order_name_), order_type_(q.order_type_), max_(q.max_),
+    skip_(q.skip_), page_size_(page_size > 0 ? page_size : 1), fetch_(fetch), paging_(paging), pos_(0),
+    has_ready_(false), done_(false), stop_(false), fetched_(0)
+  {
+    if (order_name_.empty() || (order_type_ != num_asc && order_type_ != num_desc))
+      paging_ = by_skip;
+    thread_.reset( new boost::thread(&cursor::run, this) );
+  }
+
+  // waits for a fetch in flight to come back
+  ~cursor()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    changed_.notify_all();
+    thread_->join();
+  }
+
+  // the columns of the next row.  only for cursors fetching rows
+  bool next_row(map & columns)
+  {
+    if (fetch_ != rows)
+      err::go("tokyooo: cursor is fetching keys, not rows");
+    while (pos_ >= static_cast<int>(current_.size()))
+    {
+      if (!advance())
+        return false;
+    }
+    int size = 0;
+    const void * p = tclistval(current_.native(), pos_++, &size);
+    map tmp( tcstrsplit4(p, size) );
+    columns.swap(tmp);
+    return true;
+  }
+
+  // the primary key of the next row
+  template<class Key>
+  bool next_key(Key & key)
+  {
+    int size = 0;
+    const void * p = next(size);
+    if (p == NULL)
+      return false;
+    if (fetch_rows())
+    {
+      view k = column(p, size, "");
+      unpack(key, k.data, k.size);
+    }
+    else
+      unpack(key, p, size);
+    return true;
+  }
+};
+
+typedef basic_query<> query;
+
+typedef basic_query<no_stats, local_table> tdb_query;
+
 } // tokyooo
 
 #endif // __TOKYOOO_QUERY_HPP__
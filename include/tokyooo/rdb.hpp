@@ -7,6 +7,8 @@
 #include <limits>
 #include <malloc.h>
 #include <cmath>
+#include <algorithm>
+#include <cstring>
 
 #include <boost/noncopyable.hpp>
 
@@ -14,17 +16,15 @@
 #include <tcrdb.h>
 #include "util.hpp"
 #include "map.hpp"
+#include "list.hpp"
+#include "stats.hpp"
+#include "store.hpp"
 
 namespace tokyooo {
 
-class rdb : public boost::noncopyable
+// the options, outside the template so every basic_rdb shares them
+struct rdb_base
 {
-private:
-
-  TCRDB * rdb_;
-
-public:
-
   enum open_options_e
   {
     open_default = 0,
@@ -41,6 +41,11 @@ public:
     restore_default = 0,
     check_consistency = RDBROCHKCON
   };
+  enum misc_options_e
+  {
+    misc_default = 0,
+    no_update_log = RDBMONOULOG
+  };
   enum index_options_e
   {
     lexical = RDBITLEXICAL,
@@ -51,70 +56,306 @@ public:
     remove = RDBITVOID,
     keep = RDBITKEEP
   };
+};
 
-  rdb()
-  : rdb_(tcrdbnew()) {}
+// Stats decides what gets recorded about each call - nothing, by default.  basic_rdb<op_stats>
+// counts and times them on the client side, next to what status() says about the server
+template<class Stats = no_stats>
+class basic_rdb : public rdb_base, public boost::noncopyable
+{
+private:
+
+  TCRDB * rdb_;
+
+  std::size_t batch_bytes_;
 
-  rdb(const std::string & host, int port, double timeout = 0, open_options_e options = open_default)
-  : rdb_(tcrdbnew())
+  Stats stats_;
+
+  // what a try_ call returns once tcrdb has answered.  misses and keep conflicts aren't errors
+  result outcome(bool ok, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(rdb_);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+  template<class Map>
+  size_type get_chunk(list & keys, Map & out)
+  {
+    list recs;
+    misc("getlist", keys, recs);
+    typename Map::key_type key;
+    typename Map::mapped_type value;
+    for (int i = 0; recs.get(key, i) && recs.get(value, i + 1); i += 2)
+      out[key] = value;
+    return recs.size() / 2;
+  }
+
+public:
+
+  basic_rdb()
+  : rdb_(tcrdbnew()), batch_bytes_(1 << 20) {}
+
+  basic_rdb(const std::string & host, int port, double timeout = 0, open_options_e options = open_default)
+  : rdb_(tcrdbnew()), batch_bytes_(1 << 20)
   {
     open(host, port, timeout, options);
   }
 
+  ~basic_rdb()
+  {
+    tcrdbdel(rdb_);
+  }
+
   void open(const std::string & host, int port, double timeout = 0, open_options_e options = open_default)
   {
+    typename Stats::timer t(stats_, op_open);
     tcrdbtune(rdb_, timeout, options );
     tcrdbopen(rdb_, host.c_str(), port) || err::go(rdb_);
   }
 
   void close()
   {
+    typename Stats::timer t(stats_, op_admin);
     tcrdbclose(rdb_) || err::go(rdb_);
   }
 
-  // using this for structs and stuff - maybe alignment problems?  ymmv
+  // keys and values of any type with a codec<> - see codec.hpp
   template<class Key, class Value>
   void put(const Key & key, const Value & value, put_mode_e put_mode = store, int width = 0)
   {
+    result r = try_put(key, value, put_mode, width);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    result r = try_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    result r = try_get(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  // same contract as hdb::get_into.  tcrdbget always hands back a fresh allocation, so this one
+  // still mallocs once per call - it just saves you the copy into a Value
+  template<class Key>
+  int get_into(const Key & key, void * buffer, int capacity)
+  {
+    int size = -1;
+    result r = try_get_into(key, buffer, capacity, size);
+    (r.ok() || r.not_found()) || err::go(r);
+    return size;
+  }
+
+  // points value at a copy in this thread's scratch buffer - good until this thread's next get_view
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    result r = try_get_view(key, value);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  // the same calls without the exceptions, as in hdb: each returns how it went, and only hands
+  // back a value if it went ok()
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store, int width = 0)
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key), v(value);
+    t.add_bytes(k.size() + v.size());
+    bool ok = false;
     switch (put_mode)
     {
-    case store: tcrdbput(rdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)) || err::go(rdb_); break;
-    case keep: tcrdbputkeep(rdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)) || err::go(rdb_); break;
-    case cat: tcrdbputcat(rdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)) || err::go(rdb_); break;
-    case shl: tcrdbputshl(rdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value), width) || err::go(rdb_); break;
-    case nr: tcrdbputnr(rdb_, ser::cptr(key), ser::len(key), ser::cptr(value), ser::len(value)) || err::go(rdb_); break;
+    case store: ok = tcrdbput(rdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case tokyooo::keep: ok = tcrdbputkeep(rdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case cat: ok = tcrdbputcat(rdb_, k.data(), k.size(), v.data(), v.size()); break;
+    case shl: ok = tcrdbputshl(rdb_, k.data(), k.size(), v.data(), v.size(), width); break;
+    case nr: ok = tcrdbputnr(rdb_, k.data(), k.size(), v.data(), v.size()); break;
     default: err::go("expardon me?"); break;
     }
+    return outcome(ok, t);
   }
 
   template<class Key>
-  void out(const Key & key)
+  result try_out(const Key & key)
   {
-    tcrdbout(rdb_, ser::cptr(key), ser::len(key)) || err::go(rdb_);
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tcrdbout(rdb_, k.data(), k.size()), t);
   }
 
+  // bytes that don't decode as a Value still throw - that's a bug, not a miss
   template<class Key, class Value>
-  bool get(const Key & key, Value & value)
+  result try_get(const Key & key, Value & value)
   {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
     int size = 0;
-    void * p = tcrdbget( rdb_, ser::cptr(key), ser::len(key), &size );
+    void * p = tcrdbget( rdb_, k.data(), k.size(), &size );
     if (p == NULL)
-      return false;
-    ser::assign(value, p, size);
+      return outcome(false, t);
+    t.add_bytes(k.size() + size);
+    try
+    {
+      unpack(value, p, size);
+    }
+    catch (...)
+    {
+      std::free(p);
+      throw;
+    }
     std::free(p);
-    return true;
+    return result();
+  }
+
+  template<class Key>
+  result try_get_into(const Key & key, void * buffer, int capacity, int & size)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    int got = 0;
+    void * p = tcrdbget( rdb_, k.data(), k.size(), &got );
+    if (p == NULL)
+      return outcome(false, t);
+    t.add_bytes(k.size() + got);
+    std::memcpy(buffer, p, std::min(got, capacity));
+    std::free(p);
+    size = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    int size = 0;
+    void * p = tcrdbget( rdb_, k.data(), k.size(), &size );
+    if (p == NULL)
+      return outcome(false, t);
+    t.add_bytes(k.size() + size);
+    std::vector<char> & buffer = thread_buffer();
+    if (size > static_cast<int>(buffer.size()))
+      buffer.resize(size);
+    std::memcpy(&buffer[0], p, size);
+    std::free(p);
+    value = view(&buffer[0], size);
+    return result();
   }
 
   void get(map & m)
   {
+    typename Stats::timer t(stats_, op_misc);
     tcrdbget3(rdb_, m.native()) || err::go(rdb_);
   }
 
+  // looks up every key in [begin, end) with "getlist", in as few round trips as the batch byte
+  // budget allows.  found records are written to out[key] (out's key_type and mapped_type decide
+  // how they're decoded), missing ones are left alone.  returns how many were found
+  template<class InputIterator, class Map>
+  size_type get_many(InputIterator begin, InputIterator end, Map & out)
+  {
+    size_type found = 0;
+    std::size_t bytes = 0;
+    list keys;
+    for (; begin != end; ++begin)
+    {
+      packed k(*begin);
+      tclistpush(keys.native(), k.data(), k.size());
+      bytes += k.size();
+      if (bytes >= batch_bytes_)
+      {
+        found += get_chunk(keys, out);
+        keys.clear();
+        bytes = 0;
+      }
+    }
+    if (keys.size())
+      found += get_chunk(keys, out);
+    return found;
+  }
+
+  // stores every (key, value) pair in [begin, end) with "putlist", chunked like get_many
+  template<class InputIterator>
+  void put_many(InputIterator begin, InputIterator end, misc_options_e options = misc_default)
+  {
+    std::size_t bytes = 0;
+    list args, ignored;
+    for (; begin != end; ++begin)
+    {
+      packed k(begin->first), v(begin->second);
+      tclistpush(args.native(), k.data(), k.size());
+      tclistpush(args.native(), v.data(), v.size());
+      bytes += k.size() + v.size();
+      if (bytes >= batch_bytes_)
+      {
+        misc("putlist", args, ignored, options);
+        args.clear();
+        bytes = 0;
+      }
+    }
+    if (args.size())
+      misc("putlist", args, ignored, options);
+  }
+
+  // removes every key in [begin, end) with "outlist", chunked like get_many.  missing keys are fine
+  template<class InputIterator>
+  void out_many(InputIterator begin, InputIterator end, misc_options_e options = misc_default)
+  {
+    std::size_t bytes = 0;
+    list keys, ignored;
+    for (; begin != end; ++begin)
+    {
+      packed k(*begin);
+      tclistpush(keys.native(), k.data(), k.size());
+      bytes += k.size();
+      if (bytes >= batch_bytes_)
+      {
+        misc("outlist", keys, ignored, options);
+        keys.clear();
+        bytes = 0;
+      }
+    }
+    if (keys.size())
+      misc("outlist", keys, ignored, options);
+  }
+
+  // roughly how many bytes of keys and values the *_many calls send per round trip
+  void set_batch_bytes(std::size_t bytes)
+  {
+    batch_bytes_ = bytes ? bytes : 1;
+  }
+
+  void misc(const std::string & name, list & args, list & result, misc_options_e options = misc_default)
+  {
+    typename Stats::timer t(stats_, op_misc);
+    list tmp( tcrdbmisc(rdb_, name.c_str(), options, args.native()) );
+    tmp.native() || err::go(rdb_);
+    result.swap(tmp);
+  }
+
   template<class Key>
   int vsize(const Key & key)
   {
-    int ret_val = tcrdbvsiz( rdb_, ser::cptr(key), ser::len(key) );
-    (ret_val != -1) || err::go(rdb_);
+    int ret_val = -1;
+    result r = try_vsize(key, ret_val);
+    r.ok() || err::go(r);
     return ret_val;
   }
 
@@ -123,38 +364,83 @@ public:
   template<class Key>
   int add(const Key & key, int value)
   {
-    int ret_val = tcrdbaddint(rdb_, ser::cptr(key), ser::len(key), value);
-    ( ret_val == std::numeric_limits<int>::min() ) || err::go(rdb_);
+    int ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
     return ret_val;
   }
 
   template<class Key>
-  int add(const Key & key, double value)
+  double add(const Key & key, double value)
   {
-    double ret_val = tcrdbadddouble(rdb_, ser::cptr(key), ser::len(key), value);
-    !std::isnan(ret_val) || err::go(rdb_);
+    double ret_val = 0;
+    result r = try_add(key, value, ret_val);
+    r.ok() || err::go(r);
     return ret_val;
   }
 
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    typename Stats::timer t(stats_, op_vsize);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcrdbvsiz( rdb_, k.data(), k.size() );
+    if (got == -1)
+      return outcome(false, t);
+    size = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    int got = tcrdbaddint(rdb_, k.data(), k.size(), value);
+    if (got == std::numeric_limits<int>::min())
+      return outcome(false, t);
+    sum = got;
+    return result();
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    typename Stats::timer t(stats_, op_add);
+    packed k(key);
+    t.add_bytes(k.size());
+    double got = tcrdbadddouble(rdb_, k.data(), k.size(), value);
+    if (std::isnan(got))
+      return outcome(false, t);
+    sum = got;
+    return result();
+  }
+
   template<class Key, class Value, class Result>
   void ext(const std::string & name, const Key & key, const Value & value, Result & result,
       ext_options_e options = ext_default)
   {
+    typename Stats::timer t(stats_, op_misc);
+    packed k(key), v(value);
     int size = 0;
-    void * p = tcrdbext( rdb_, name.c_str(), options, ser::cptr(key), ser::len(key), ser::cptr(value),
-        ser::len(value), &size );
+    void * p = tcrdbext( rdb_, name.c_str(), options, k.data(), k.size(), v.data(), v.size(), &size );
+    t.add_bytes(k.size() + v.size() + size);
     p || err::go(rdb_);
-    ser::assign(value, p, size);
+    unpack(result, p, size);
     std::free(p);
   }
 
   void sync()
   {
+    typename Stats::timer t(stats_, op_admin);
     tcrdbsync(rdb_) || err::go(rdb_);
   }
 
   void optimize(const std::string & params = "")
   {
+    typename Stats::timer t(stats_, op_admin);
     if (params.empty())
       tcrdboptimize(rdb_, NULL) || err::go(rdb_);
     else
@@ -163,21 +449,25 @@ public:
 
   void vanish()
   {
+    typename Stats::timer t(stats_, op_admin);
     tcrdbvanish(rdb_) || err::go(rdb_);
   }
 
   void copy(const std::string & path)
   {
+    typename Stats::timer t(stats_, op_admin);
     tcrdbcopy(rdb_, path.c_str()) || err::go(rdb_);
   }
 
   void restore(const std::string & path, size_type timestamp, restore_options_e options = restore_default )
   {
+    typename Stats::timer t(stats_, op_admin);
     tcrdbrestore(rdb_, path.c_str(), timestamp, options) || err::go(rdb_);
   }
 
   void set_master(const std::string & host, int port, size_type timestamp, restore_options_e options = restore_default)
   {
+    typename Stats::timer t(stats_, op_admin);
     tcrdbsetmst(rdb_, host.c_str(), port, timestamp, options) || err::go(rdb_);
   }
 
@@ -201,33 +491,74 @@ public:
     return ret_val;
   }
 
+  // status(), split into its fields - "rnum", "size", "delay" and so on
+  void status(std::map<std::string, std::string> & fields)
+  {
+    parse_status(status(), fields);
+  }
+
   // table api:
   template<class Key>
   void tbl_put( const Key & key, map & row, put_mode_e mode = store )
   {
+    result r = try_tbl_put(key, row, mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void tbl_out(const Key & key)
+  {
+    result r = try_tbl_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  bool tbl_get(const Key & key, map & m)
+  {
+    result r = try_tbl_get(key, m);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  result try_tbl_put( const Key & key, map & row, put_mode_e mode = store )
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key);
+    t.add_bytes(k.size());
+    bool ok = false;
     switch (mode)
     {
-    case store: tcrdbtblput(rdb_, ser::cptr(key), ser::len(key), row.native() ) || err::go(rdb_); break;
-    case keep: tcrdbtblputkeep(rdb_, ser::cptr(key), ser::len(key), row.native() ) || err::go(rdb_); break;
-    case cat: tcrdbtblputcat(rdb_, ser::cptr(key), ser::len(key), row.native() ) || err::go(rdb_); break;
+    case store: ok = tcrdbtblput(rdb_, k.data(), k.size(), row.native() ); break;
+    case tokyooo::keep: ok = tcrdbtblputkeep(rdb_, k.data(), k.size(), row.native() ); break;
+    case cat: ok = tcrdbtblputcat(rdb_, k.data(), k.size(), row.native() ); break;
     default: err::go("expardon me?"); break;
     }
+    return outcome(ok, t);
   }
 
   template<class Key>
-  void tbl_out(const Key & key)
+  result try_tbl_out(const Key & key)
   {
-    tcrdbtblout(rdb_, ser::cptr(key), ser::len(key)) || err::go(rdb_);
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tcrdbtblout(rdb_, k.data(), k.size()), t);
   }
 
   template<class Key>
-  bool tbl_get(const Key & key, map & m)
+  result try_tbl_get(const Key & key, map & m)
   {
-    map tmp( tcrdbtblget( rdb_, ser::cptr(key), ser::len(key) ) );
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    map tmp( tcrdbtblget( rdb_, k.data(), k.size() ) );
     if (!tmp.native())
-      return false;
+      return outcome(false, t);
     m.swap(tmp);
-    return true;
+    return result();
   }
 
   void set_index( const std::string & name, index_options_e options )
@@ -245,8 +576,26 @@ public:
     return rdb_;
   }
 
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  // op_stats copies share their counts, so a pool of connections can report as one
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+
 };
 
+template<class Stats>
+struct supports_tables< basic_rdb<Stats> > : boost::true_type {};
+
+typedef basic_rdb<> rdb;
+
+BOOST_CONCEPT_ASSERT((Store<rdb>));
+
 } // tokyooo
 
 #endif // __TOKYOOO_RDB_HPP__
@@ -0,0 +1,262 @@
+#ifndef __TOKYOOO_RDB_POOL_HPP__
+#define __TOKYOOO_RDB_POOL_HPP__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <tcrdb.h>
+#include "util.hpp"
+#include "rdb.hpp"
+
+namespace tokyooo {
+
+// a set of open connections to one tyrant server, shared between threads.  min_size are opened up
+// front, more are opened as needed up to max_size, after which callers wait (up to wait_timeout)
+// for somebody to give one back.  borrow one with a lease:
+//
+//   rdb_pool::lease r(pool);
+//   r->put(key, value);
+//
+// a connection that comes back with a network error on it is closed rather than reused, and a
+// fresh one is opened the next time one's needed.
+class rdb_pool : public boost::noncopyable
+{
+public:
+
+  struct stats
+  {
+    boost::uint64_t acquired;     // leases handed out
+    boost::uint64_t waited;       // ...that had to wait because every connection was busy
+    boost::uint64_t wait_usec;    // total time spent waiting
+    boost::uint64_t max_wait_usec;
+    boost::uint64_t timeouts;     // acquires that gave up
+    boost::uint64_t created;      // connections opened, including replacements
+    boost::uint64_t dropped;      // connections thrown away after an error
+    std::size_t open;             // connections open right now
+    std::size_t idle;             // ...and not leased
+    std::size_t max_size;
+  };
+
+  class lease : public boost::noncopyable
+  {
+  private:
+
+    rdb_pool & pool_;
+
+    rdb * rdb_;
+
+    bool broken_;
+
+  public:
+
+    lease(rdb_pool & pool)
+    : pool_(pool), rdb_(pool.acquire(pool.wait_timeout_)), broken_(false) {}
+
+    lease(rdb_pool & pool, const boost::posix_time::time_duration & wait_timeout)
+    : pool_(pool), rdb_(pool.acquire(wait_timeout)), broken_(false) {}
+
+    ~lease()
+    {
+      pool_.release(rdb_, broken_);
+    }
+
+    rdb & operator* () { return *rdb_; }
+
+    rdb * operator-> () { return rdb_; }
+
+    // don't put this connection back in the pool - close it instead
+    void set_broken() { broken_ = true; }
+  };
+
+private:
+
+  std::string host_;
+
+  int port_;
+
+  double timeout_;
+
+  rdb::open_options_e options_;
+
+  std::size_t max_size_;
+
+  boost::posix_time::time_duration wait_timeout_;
+
+  boost::mutex mutex_;
+
+  boost::condition_variable available_;
+
+  std::vector<rdb *> idle_;
+
+  stats stats_;
+
+  static bool network_error(int ecode)
+  {
+    return ecode == TTEINVALID || ecode == TTENOHOST || ecode == TTEREFUSED || ecode == TTESEND || ecode == TTERECV;
+  }
+
+  rdb * connect()
+  {
+    return new rdb(host_, port_, timeout_, options_);
+  }
+
+  // takes the lock on its own so it can open a new connection without holding it
+  rdb * acquire(const boost::posix_time::time_duration & wait_timeout)
+  {
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    boost::mutex::scoped_lock lock(mutex_);
+    bool waited = false;
+    while (idle_.empty())
+    {
+      if (stats_.open < max_size_)
+      {
+        ++stats_.open;
+        lock.unlock();
+        rdb * ret_val = NULL;
+        try
+        {
+          ret_val = connect();
+        }
+        catch (...)
+        {
+          lock.lock();
+          --stats_.open;
+          available_.notify_one();
+          throw;
+        }
+        lock.lock();
+        ++stats_.created;
+        ++stats_.acquired;
+        return ret_val;
+      }
+      waited = true;
+      if (!available_.timed_wait(lock, start + wait_timeout) && idle_.empty())
+      {
+        ++stats_.timeouts;
+        err::go("tokyooo: timed out waiting for a pooled connection");
+      }
+    }
+    rdb * ret_val = idle_.back();
+    idle_.pop_back();
+    ++stats_.acquired;
+    if (waited)
+    {
+      boost::uint64_t usec = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+      ++stats_.waited;
+      stats_.wait_usec += usec;
+      stats_.max_wait_usec = std::max(stats_.max_wait_usec, usec);
+    }
+    return ret_val;
+  }
+
+  void release(rdb * r, bool broken)
+  {
+    broken = broken || network_error(tcrdbecode(r->native()));
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (!broken)
+        idle_.push_back(r);
+      else
+      {
+        --stats_.open;
+        ++stats_.dropped;
+      }
+    }
+    available_.notify_one();
+    if (broken)
+      delete r;
+  }
+
+public:
+
+  rdb_pool( const std::string & host,
+            int port,
+            std::size_t min_size,
+            std::size_t max_size,
+            double timeout = 0,
+            rdb::open_options_e options = rdb::open_default,
+            const boost::posix_time::time_duration & wait_timeout = boost::posix_time::seconds(5) )
+  : host_(host), port_(port), timeout_(timeout), options_(options), max_size_(std::max(min_size, max_size)),
+    wait_timeout_(wait_timeout)
+  {
+    stats s = {};
+    stats_ = s;
+    stats_.max_size = max_size_;
+    idle_.reserve(max_size_);
+    try
+    {
+      for (; stats_.open < min_size; ++stats_.open, ++stats_.created)
+        idle_.push_back(connect());
+    }
+    catch (...)
+    {
+      clear();
+      throw;
+    }
+  }
+
+  // every lease has to be back before the pool goes away
+  ~rdb_pool()
+  {
+    clear();
+  }
+
+  // pings every idle connection and closes the ones that don't answer
+  void health_check()
+  {
+    std::vector<rdb *> checking;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      checking.swap(idle_);
+    }
+    std::vector<rdb *> healthy, dead;
+    for (std::vector<rdb *>::iterator it = checking.begin(); it != checking.end(); ++it)
+    {
+      char * p = tcrdbstat((*it)->native());
+      (p ? healthy : dead).push_back(*it);
+      std::free(p);
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      idle_.insert(idle_.end(), healthy.begin(), healthy.end());
+      stats_.open -= dead.size();
+      stats_.dropped += dead.size();
+    }
+    available_.notify_all();
+    for (std::vector<rdb *>::iterator it = dead.begin(); it != dead.end(); ++it)
+      delete *it;
+  }
+
+  // closes the idle connections.  leased ones are left alone
+  void clear()
+  {
+    std::vector<rdb *> closing;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      closing.swap(idle_);
+      stats_.open -= closing.size();
+    }
+    for (std::vector<rdb *>::iterator it = closing.begin(); it != closing.end(); ++it)
+      delete *it;
+  }
+
+  stats statistics()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stats ret_val = stats_;
+    ret_val.idle = idle_.size();
+    return ret_val;
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_RDB_POOL_HPP__
@@ -0,0 +1,145 @@
+#ifndef __TOKYOOO_SHARDED_HDB_HPP__
+#define __TOKYOOO_SHARDED_HDB_HPP__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "util.hpp"
+#include "hdb.hpp"
+#include "sharded_store.hpp"
+#include "parallel.hpp"
+
+namespace tokyooo {
+
+// n hash databases, path.0 ... path.n-1, each with its own lock, and every key living in the one
+// its hash picks.  threads working on different shards don't wait on each other, where a single
+// mutexed hdb serializes every write through one lock.  the shard count is part of the data: open
+// the same files with a different n and keys won't be found where they were put.  the Store calls
+// are sharded_store's; this adds the files, and what's particular to hdb.
+class sharded_hdb : public sharded_store<hdb>
+{
+private:
+
+  std::string path_;
+
+  static std::string shard_path(const std::string & path, std::size_t i)
+  {
+    return path + "." + boost::lexical_cast<std::string>(i);
+  }
+
+  // a shard's share of bnum.  0 or less is tchdb's default, and goes to every shard as it is
+  static boost::int64_t split(boost::int64_t bnum, std::size_t shards)
+  {
+    return bnum > 0 ? std::max<boost::int64_t>(bnum / boost::int64_t(shards), 1) : bnum;
+  }
+
+  struct optimize_job
+  {
+    sharded_hdb & h;
+    boost::int64_t bnum;
+    char apow;
+    char fpow;
+    hdb::tune_options_e opts;
+
+    void operator() (std::size_t i)
+    {
+      boost::mutex::scoped_lock lock(h.mutexes_[i]);
+      h.shards_[i]->optimize(bnum, apow, fpow, opts);
+    }
+  };
+
+  struct copy_job
+  {
+    sharded_hdb & h;
+    const std::string & path;
+
+    void operator() (std::size_t i)
+    {
+      boost::mutex::scoped_lock lock(h.mutexes_[i]);
+      h.shards_[i]->copy(shard_path(path, i));
+    }
+  };
+
+public:
+
+  // bnum is for the whole set, and gets split evenly between the shards
+  sharded_hdb( const std::string & path,
+               std::size_t shards,
+               hdb::open_options_e options = hdb::open_default,
+               boost::int64_t bnum = 131071,
+               char apow = 4,
+               char fpow = 10,
+               hdb::tune_options_e opts = hdb::tune_default,
+               int rcnum = 0,
+               boost::int64_t xmsize = 67108864 )
+  : sharded_store<hdb>(shards), path_(path)
+  {
+    if (shards == 0)
+      shards = 1;
+    boost::int64_t shard_bnum = split(bnum, shards);
+    for (std::size_t i = 0; i < shards; ++i)
+    {
+      boost::shared_ptr<hdb> h( new hdb(false, shard_bnum, apow, fpow, opts, rcnum, xmsize / shards) );
+      h->open(shard_path(path, i), options);
+      shards_.push_back(h);
+    }
+  }
+
+  template<class Key>
+  int get_into(const Key & key, void * buffer, int capacity)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->get_into(key, buffer, capacity);
+  }
+
+  // bnum is for the whole set, like the constructor's
+  void optimize( boost::int64_t bnum, char apow, char fpow, hdb::tune_options_e opts )
+  {
+    boost::int64_t shard_bnum = split(bnum, shards_.size());
+    optimize_job job = { *this, shard_bnum, apow, fpow, opts };
+    parallel_for(shards_.size(), job);
+  }
+
+  // writes path.0 ... path.n-1
+  void copy(const std::string & path)
+  {
+    copy_job job = { *this, path };
+    parallel_for(shards_.size(), job);
+  }
+
+  void close()
+  {
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+      boost::mutex::scoped_lock lock(mutexes_[i]);
+      shards_[i]->close();
+    }
+  }
+
+  std::string path() const
+  {
+    return path_;
+  }
+
+  size_type fsize()
+  {
+    size_type ret_val = 0;
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+      boost::mutex::scoped_lock lock(mutexes_[i]);
+      ret_val += shards_[i]->fsize();
+    }
+    return ret_val;
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_SHARDED_HDB_HPP__
@@ -0,0 +1,294 @@
+#ifndef __TOKYOOO_SHARDED_RDB_HPP__
+#define __TOKYOOO_SHARDED_RDB_HPP__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iterator>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "util.hpp"
+#include "map.hpp"
+#include "rdb.hpp"
+#include "parallel.hpp"
+
+namespace tokyooo {
+
+// spreads keys over several tyrant servers with a consistent hash ring.  each server gets vnodes
+// points on the ring (times its weight), and a key belongs to the first point at or after the hash
+// of its encoding.  adding or removing a server only moves the keys on the arcs it gains or loses,
+// about 1/n of them.  one connection per server, so like rdb it's one thread at a time.
+class sharded_rdb : public boost::noncopyable
+{
+private:
+
+  struct server
+  {
+    boost::shared_ptr<rdb> conn;
+    std::size_t points;
+  };
+
+  typedef std::map<std::string, server> servers_t; // by "host:port"
+
+  typedef std::map<boost::uint64_t, rdb *> ring_t;
+
+  servers_t servers_;
+
+  ring_t ring_;
+
+  std::size_t vnodes_;
+
+  double timeout_;
+
+  rdb::open_options_e options_;
+
+  static std::string point_name(const std::string & name, std::size_t i)
+  {
+    return name + "#" + boost::lexical_cast<std::string>(i);
+  }
+
+  static std::string server_name(const std::string & host, int port)
+  {
+    return host + ":" + boost::lexical_cast<std::string>(port);
+  }
+
+  rdb & owner(boost::uint64_t h)
+  {
+    if (ring_.empty())
+      err::go("tokyooo: sharded_rdb has no servers");
+    ring_t::iterator it = ring_.lower_bound(h);
+    return *(it == ring_.end() ? ring_.begin() : it)->second;
+  }
+
+  // keys (or key/value pairs) split up by the shard that owns them
+  template<class T>
+  struct groups
+  {
+    std::vector<rdb *> shards;
+    std::vector< std::vector<T> > items;
+
+    void add(rdb * shard, const T & item)
+    {
+      std::size_t i = 0;
+      while (i < shards.size() && shards[i] != shard)
+        ++i;
+      if (i == shards.size())
+      {
+        shards.push_back(shard);
+        items.push_back(std::vector<T>());
+      }
+      items[i].push_back(item);
+    }
+  };
+
+  template<class Key, class Map>
+  struct get_many_job
+  {
+    groups<Key> & g;
+    std::vector<Map> & results;
+    std::vector<size_type> & found;
+
+    void operator() (std::size_t i)
+    {
+      found[i] = g.shards[i]->get_many(g.items[i].begin(), g.items[i].end(), results[i]);
+    }
+  };
+
+  template<class Pair>
+  struct put_many_job
+  {
+    groups<Pair> & g;
+    rdb::misc_options_e options;
+
+    void operator() (std::size_t i)
+    {
+      g.shards[i]->put_many(g.items[i].begin(), g.items[i].end(), options);
+    }
+  };
+
+  template<class Key>
+  struct out_many_job
+  {
+    groups<Key> & g;
+    rdb::misc_options_e options;
+
+    void operator() (std::size_t i)
+    {
+      g.shards[i]->out_many(g.items[i].begin(), g.items[i].end(), options);
+    }
+  };
+
+public:
+
+  // connections to every server are opened with this timeout and these options
+  sharded_rdb( std::size_t vnodes = 160,
+               double timeout = 0,
+               rdb::open_options_e options = rdb::open_default )
+  : vnodes_(vnodes ? vnodes : 1), timeout_(timeout), options_(options) {}
+
+  void add_server(const std::string & host, int port, std::size_t weight = 1)
+  {
+    std::string name = server_name(host, port);
+    if (servers_.count(name))
+      err::go("tokyooo: " + name + " is already in the ring");
+    server s;
+    s.conn.reset(new rdb(host, port, timeout_, options_));
+    s.points = vnodes_ * (weight ? weight : 1);
+    for (std::size_t i = 0; i < s.points; ++i)
+    {
+      std::string point = point_name(name, i);
+      ring_[hash(point.data(), point.size())] = s.conn.get();
+    }
+    servers_[name] = s;
+  }
+
+  void remove_server(const std::string & host, int port)
+  {
+    std::string name = server_name(host, port);
+    servers_t::iterator it = servers_.find(name);
+    if (it == servers_.end())
+      return;
+    for (std::size_t i = 0; i < it->second.points; ++i)
+    {
+      std::string point = point_name(name, i);
+      ring_t::iterator p = ring_.find(hash(point.data(), point.size()));
+      if (p != ring_.end() && p->second == it->second.conn.get())
+        ring_.erase(p);
+    }
+    servers_.erase(it);
+  }
+
+  std::size_t server_count() const
+  {
+    return servers_.size();
+  }
+
+  // the connection that owns key
+  template<class Key>
+  rdb & shard(const Key & key)
+  {
+    return owner(hash_key(key));
+  }
+
+  void shards(std::vector<rdb *> & out)
+  {
+    out.clear();
+    for (servers_t::iterator it = servers_.begin(); it != servers_.end(); ++it)
+      out.push_back(it->second.conn.get());
+  }
+
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store, int width = 0)
+  {
+    shard(key).put(key, value, put_mode, width);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    shard(key).out(key);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    return shard(key).get(key, value);
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    return shard(key).vsize(key);
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    return shard(key).add(key, value);
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    return shard(key).add(key, value);
+  }
+
+  template<class Key>
+  void tbl_put( const Key & key, map & row, put_mode_e mode = store )
+  {
+    shard(key).tbl_put(key, row, mode);
+  }
+
+  template<class Key>
+  void tbl_out(const Key & key)
+  {
+    shard(key).tbl_out(key);
+  }
+
+  template<class Key>
+  bool tbl_get(const Key & key, map & m)
+  {
+    return shard(key).tbl_get(key, m);
+  }
+
+  // splits the keys up by shard and runs one rdb::get_many per shard, all at once
+  template<class InputIterator, class Map>
+  size_type get_many(InputIterator begin, InputIterator end, Map & out)
+  {
+    typedef typename std::iterator_traits<InputIterator>::value_type key_type;
+    groups<key_type> g;
+    for (; begin != end; ++begin)
+      g.add(&shard(*begin), *begin);
+    std::vector<Map> results(g.shards.size());
+    std::vector<size_type> found(g.shards.size());
+    get_many_job<key_type, Map> job = { g, results, found };
+    parallel_for(g.shards.size(), job);
+    size_type ret_val = 0;
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+      for (typename Map::const_iterator it = results[i].begin(); it != results[i].end(); ++it)
+        out[it->first] = it->second;
+      ret_val += found[i];
+    }
+    return ret_val;
+  }
+
+  template<class InputIterator>
+  void put_many(InputIterator begin, InputIterator end, rdb::misc_options_e options = rdb::misc_default)
+  {
+    typedef typename std::iterator_traits<InputIterator>::value_type pair_type;
+    groups<pair_type> g;
+    for (; begin != end; ++begin)
+      g.add(&shard(begin->first), *begin);
+    put_many_job<pair_type> job = { g, options };
+    parallel_for(g.shards.size(), job);
+  }
+
+  template<class InputIterator>
+  void out_many(InputIterator begin, InputIterator end, rdb::misc_options_e options = rdb::misc_default)
+  {
+    typedef typename std::iterator_traits<InputIterator>::value_type key_type;
+    groups<key_type> g;
+    for (; begin != end; ++begin)
+      g.add(&shard(*begin), *begin);
+    out_many_job<key_type> job = { g, options };
+    parallel_for(g.shards.size(), job);
+  }
+
+  // records on every server put together
+  size_type size()
+  {
+    size_type ret_val = 0;
+    for (servers_t::iterator it = servers_.begin(); it != servers_.end(); ++it)
+      ret_val += it->second.conn->size();
+    return ret_val;
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_SHARDED_RDB_HPP__
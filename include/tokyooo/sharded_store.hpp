@@ -0,0 +1,267 @@
+#ifndef __TOKYOOO_SHARDED_STORE_HPP__
+#define __TOKYOOO_SHARDED_STORE_HPP__
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "util.hpp"
+#include "map.hpp"
+#include "store.hpp"
+#include "parallel.hpp"
+
+namespace tokyooo {
+
+// any number of Stores (see store.hpp), each with its own lock, and every key living in the one
+// its hash picks.  threads working on different shards don't wait on each other.  the shards are
+// built by the caller, so they can be any mix of files or servers, as long as they're all the same
+// type; their order is part of the data - hand them over in a different order, or a different
+// number of them, and keys won't be found where they were put.
+template<class Store>
+class sharded_store : public boost::noncopyable
+{
+private:
+
+  BOOST_CONCEPT_ASSERT((tokyooo::Store<Store>));
+
+  struct sync_job
+  {
+    sharded_store & s;
+
+    void operator() (std::size_t i)
+    {
+      boost::mutex::scoped_lock lock(s.mutexes_[i]);
+      s.shards_[i]->sync();
+    }
+  };
+
+protected:
+
+  std::vector< boost::shared_ptr<Store> > shards_;
+
+  boost::scoped_array<boost::mutex> mutexes_;
+
+  template<class Key>
+  std::size_t index(const Key & key) const
+  {
+    return hash_key(key) % shards_.size();
+  }
+
+  // room for n shards, for a subclass to fill in shards_
+  explicit sharded_store(std::size_t n)
+  : mutexes_(new boost::mutex[n ? n : 1]) {}
+
+public:
+
+  explicit sharded_store(const std::vector< boost::shared_ptr<Store> > & shards)
+  : shards_(shards), mutexes_(new boost::mutex[shards.size() ? shards.size() : 1])
+  {
+    if (shards_.empty())
+      err::go("tokyooo: sharded_store needs at least one shard");
+  }
+
+  std::size_t shard_count() const
+  {
+    return shards_.size();
+  }
+
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    shards_[i]->put(key, value, put_mode);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    shards_[i]->out(key);
+  }
+
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->get(key, value);
+  }
+
+  // the buffer is per thread, so this needs no more locking than get
+  template<class Key>
+  bool get_view(const Key & key, view & value)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->get_view(key, value);
+  }
+
+  template<class Key>
+  int vsize(const Key & key)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->vsize(key);
+  }
+
+  template<class Key>
+  int add(const Key & key, int value)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->add(key, value);
+  }
+
+  template<class Key>
+  double add(const Key & key, double value)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->add(key, value);
+  }
+
+  template<class Key, class Value>
+  result try_put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->try_put(key, value, put_mode);
+  }
+
+  template<class Key>
+  result try_out(const Key & key)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->try_out(key);
+  }
+
+  template<class Key, class Value>
+  result try_get(const Key & key, Value & value)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->try_get(key, value);
+  }
+
+  template<class Key>
+  result try_get_view(const Key & key, view & value)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->try_get_view(key, value);
+  }
+
+  template<class Key>
+  result try_vsize(const Key & key, int & size)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->try_vsize(key, size);
+  }
+
+  template<class Key>
+  result try_add(const Key & key, int value, int & sum)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->try_add(key, value, sum);
+  }
+
+  template<class Key>
+  result try_add(const Key & key, double value, double & sum)
+  {
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->try_add(key, value, sum);
+  }
+
+  // only if the shards have tables
+  template<class Key>
+  void tbl_put( const Key & key, map & row, put_mode_e mode = store )
+  {
+    BOOST_STATIC_ASSERT(supports_tables<Store>::value);
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    shards_[i]->tbl_put(key, row, mode);
+  }
+
+  template<class Key>
+  void tbl_out(const Key & key)
+  {
+    BOOST_STATIC_ASSERT(supports_tables<Store>::value);
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    shards_[i]->tbl_out(key);
+  }
+
+  template<class Key>
+  bool tbl_get(const Key & key, map & m)
+  {
+    BOOST_STATIC_ASSERT(supports_tables<Store>::value);
+    std::size_t i = index(key);
+    boost::mutex::scoped_lock lock(mutexes_[i]);
+    return shards_[i]->tbl_get(key, m);
+  }
+
+  // calls f(record) for every record, a shard at a time with that shard locked, so f mustn't
+  // touch this sharded_store.  the records are views that go stale once f returns.  only for
+  // Stores with iterators (hdb, bdb)
+  template<class F>
+  void for_each(F f)
+  {
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+      boost::mutex::scoped_lock lock(mutexes_[i]);
+      for (typename Store::iterator it = shards_[i]->begin(); it != shards_[i]->end(); ++it)
+        f(*it);
+    }
+  }
+
+  // on every shard at once
+  void sync()
+  {
+    sync_job job = { *this };
+    parallel_for(shards_.size(), job);
+  }
+
+  void vanish()
+  {
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+      boost::mutex::scoped_lock lock(mutexes_[i]);
+      shards_[i]->vanish();
+    }
+  }
+
+  size_type size()
+  {
+    size_type ret_val = 0;
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+      boost::mutex::scoped_lock lock(mutexes_[i]);
+      ret_val += shards_[i]->size();
+    }
+    return ret_val;
+  }
+
+  // the shard that owns key, unlocked - for the odd thing this class doesn't do itself
+  template<class Key>
+  Store & shard(const Key & key)
+  {
+    return *shards_[index(key)];
+  }
+};
+
+template<class Store>
+struct supports_tables< sharded_store<Store> > : supports_tables<Store> {};
+
+} // tokyooo
+
+#endif // __TOKYOOO_SHARDED_STORE_HPP__
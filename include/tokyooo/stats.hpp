@@ -0,0 +1,385 @@
+#ifndef __TOKYOOO_STATS_HPP__
+#define __TOKYOOO_STATS_HPP__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+#include <cstdlib>
+#include <ctime>
+#include <cctype>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/atomic.hpp>
+#include <boost/core/uncaught_exceptions.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace tokyooo {
+
+// what basic_hdb, basic_rdb and basic_query count their calls as
+enum stats_op_e
+{
+  op_open,
+  op_put,       // put, tbl_put
+  op_get,       // get, get_into, get_view, tbl_get
+  op_out,       // out, tbl_out
+  op_add,
+  op_vsize,
+  op_iterate,   // a step of an iterator
+  op_misc,      // misc, ext, get(map &), the *_many calls and hdb::batch commits
+  op_search,    // queries
+  op_admin,     // sync, optimize, vanish, copy, ...
+  stats_op_count
+};
+
+inline const char * stats_op_name(stats_op_e op)
+{
+  static const char * names[] = { "open", "put", "get", "out", "add", "vsize", "iterate", "misc", "search", "admin" };
+  return names[op];
+}
+
+// the default policy: records nothing, and compiles away to nothing
+struct no_stats
+{
+  struct timer
+  {
+    timer(no_stats &, stats_op_e) {}
+
+    void add_bytes(std::size_t) {}
+
+    void add_error() {}
+  };
+};
+
+// log-linear buckets in the style of hdrhistogram: exact below 16ns, then 16 buckets per power of
+// two, so any recorded latency is within about 6% of what's reported
+struct latency_buckets
+{
+  static const int sub_bits = 4;
+
+  static const int max_exponent = 40; // ~18 minutes, in ns
+
+  static const int count = (max_exponent - sub_bits + 2) << sub_bits;
+
+  static int index(boost::uint64_t ns)
+  {
+    if (ns < (1u << sub_bits))
+      return static_cast<int>(ns);
+    int e = 63 - __builtin_clzll(ns);
+    if (e > max_exponent)
+      return count - 1;
+    int sub = static_cast<int>((ns >> (e - sub_bits)) & ((1 << sub_bits) - 1));
+    return ((e - sub_bits + 1) << sub_bits) + sub;
+  }
+
+  // the middle of bucket i
+  static boost::uint64_t value(int i)
+  {
+    if (i < (1 << sub_bits))
+      return i;
+    int e = (i >> sub_bits) + sub_bits - 1;
+    boost::uint64_t low = (boost::uint64_t(1) << e) + (boost::uint64_t(i & ((1 << sub_bits) - 1)) << (e - sub_bits));
+    return low + (boost::uint64_t(1) << (e - sub_bits)) / 2;
+  }
+};
+
+struct op_snapshot
+{
+  boost::uint64_t count;
+  boost::uint64_t errors;   // calls that threw, or try_ calls that failed()
+  boost::uint64_t bytes;    // keys and values sent and received, where the call sees them
+  boost::uint64_t sum_ns;
+  std::vector<boost::uint64_t> buckets;
+
+  op_snapshot() : count(0), errors(0), bytes(0), sum_ns(0), buckets(latency_buckets::count) {}
+
+  // q in [0, 1], in ns
+  boost::uint64_t percentile(double q) const
+  {
+    if (count == 0)
+      return 0;
+    boost::uint64_t rank = static_cast<boost::uint64_t>(q * (count - 1)) + 1, seen = 0;
+    for (int i = 0; i < latency_buckets::count; ++i)
+    {
+      seen += buckets[i];
+      if (seen >= rank)
+        return latency_buckets::value(i);
+    }
+    return latency_buckets::value(latency_buckets::count - 1);
+  }
+};
+
+struct stats_snapshot
+{
+  op_snapshot ops[stats_op_count];
+};
+
+// the recording policy.  each thread counts into its own block, with single-writer atomics and no
+// locks, and snapshot() adds the blocks up; a thread's block is folded into one for all the exited
+// threads when it exits.  copies share their counts, so one op_stats can be
+// handed to several connections - see basic_rdb::set_stats
+class op_stats
+{
+private:
+
+  struct counters
+  {
+    boost::atomic<boost::uint64_t> count;
+    boost::atomic<boost::uint64_t> errors;
+    boost::atomic<boost::uint64_t> bytes;
+    boost::atomic<boost::uint64_t> sum_ns;
+    boost::atomic<boost::uint64_t> buckets[latency_buckets::count];
+
+    counters() : count(0), errors(0), bytes(0), sum_ns(0)
+    {
+      for (int i = 0; i < latency_buckets::count; ++i)
+        buckets[i].store(0, boost::memory_order_relaxed);
+    }
+  };
+
+  // only ever written by its own thread, so a relaxed load and store is enough for an increment
+  static void bump(boost::atomic<boost::uint64_t> & c, boost::uint64_t n)
+  {
+    c.store(c.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+  }
+
+  struct thread_block
+  {
+    counters ops[stats_op_count];
+  };
+
+  static void add(counters & into, const counters & from)
+  {
+    bump(into.count, from.count.load(boost::memory_order_relaxed));
+    bump(into.errors, from.errors.load(boost::memory_order_relaxed));
+    bump(into.bytes, from.bytes.load(boost::memory_order_relaxed));
+    bump(into.sum_ns, from.sum_ns.load(boost::memory_order_relaxed));
+    for (int i = 0; i < latency_buckets::count; ++i)
+      bump(into.buckets[i], from.buckets[i].load(boost::memory_order_relaxed));
+  }
+
+  struct registry;
+
+  // what a thread holds on to.  when the thread exits, its counts are added to the registry's
+  // retired block and its own is freed, so threads coming and going don't pile up blocks.  if the
+  // registry has gone first there's nothing to add them to
+  struct handle
+  {
+    boost::shared_ptr<thread_block> block;
+    boost::weak_ptr<registry> owner;
+
+    ~handle(); // after registry, below
+  };
+
+  typedef std::map<const registry *, boost::shared_ptr<handle> > handles;
+
+  // a thread's handles, one per registry it has counted into.  one thread_specific_ptr for all the
+  // registries, and never destroyed: a registry can go while threads that counted into it are still
+  // running, and boost wants every thread's value gone before a thread_specific_ptr is
+  static handles & local_handles()
+  {
+    static boost::thread_specific_ptr<handles> * local = new boost::thread_specific_ptr<handles>;
+    handles * ret_val = local->get();
+    if (ret_val == NULL)
+    {
+      ret_val = new handles;
+      local->reset(ret_val);
+    }
+    return *ret_val;
+  }
+
+  struct registry : public boost::enable_shared_from_this<registry>
+  {
+    boost::mutex mutex;
+    std::vector< boost::shared_ptr<thread_block> > blocks;
+    thread_block retired;                    // what threads that have exited counted
+
+    thread_block & mine()
+    {
+      handles & h = local_handles();
+      boost::shared_ptr<handle> & ret_val = h[this];
+      // an expired owner is a registry that was at this address before, so the handle isn't ours
+      if (!ret_val || ret_val->owner.expired())
+      {
+        boost::shared_ptr<thread_block> b(new thread_block);
+        {
+          boost::mutex::scoped_lock lock(mutex);
+          blocks.push_back(b);
+        }
+        ret_val.reset(new handle);
+        ret_val->block = b;
+        ret_val->owner = shared_from_this();
+        for (handles::iterator i = h.begin(); i != h.end(); )
+        {
+          if (i->second->owner.expired())
+            h.erase(i++);
+          else
+            ++i;
+        }
+      }
+      return *ret_val->block;
+    }
+
+    // the block's thread has stopped writing to it, so under the lock this is all of it
+    void retire(const boost::shared_ptr<thread_block> & b)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      for (int op = 0; op < stats_op_count; ++op)
+        add(retired.ops[op], b->ops[op]);
+      blocks.erase(std::remove(blocks.begin(), blocks.end(), b), blocks.end());
+    }
+  };
+
+  boost::shared_ptr<registry> registry_;
+
+  static boost::uint64_t now_ns()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return boost::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+public:
+
+  // times one call.  if it's left by an exception, or add_error() is called, the call counts as an
+  // error
+  class timer
+  {
+  private:
+
+    counters & c_;
+
+    boost::uint64_t start_;
+
+    boost::uint64_t bytes_;
+
+    unsigned int uncaught_;
+
+    bool error_;
+
+  public:
+
+    timer(op_stats & s, stats_op_e op)
+    : c_(s.registry_->mine().ops[op]), start_(now_ns()), bytes_(0),
+      uncaught_(boost::core::uncaught_exceptions()), error_(false) {}
+
+    ~timer()
+    {
+      boost::uint64_t ns = now_ns() - start_;
+      bump(c_.count, 1);
+      bump(c_.bytes, bytes_);
+      bump(c_.sum_ns, ns);
+      bump(c_.buckets[latency_buckets::index(ns)], 1);
+      if (error_ || boost::core::uncaught_exceptions() > uncaught_)
+        bump(c_.errors, 1);
+    }
+
+    void add_bytes(std::size_t n) { bytes_ += n; }
+
+    void add_error() { error_ = true; }
+  };
+
+  op_stats() : registry_(new registry) {}
+
+  stats_snapshot snapshot() const
+  {
+    stats_snapshot ret_val;
+    boost::mutex::scoped_lock lock(registry_->mutex);
+    for (std::size_t b = 0; b <= registry_->blocks.size(); ++b)
+    {
+      const thread_block & block = b < registry_->blocks.size() ? *registry_->blocks[b] : registry_->retired;
+      for (int op = 0; op < stats_op_count; ++op)
+      {
+        const counters & c = block.ops[op];
+        op_snapshot & s = ret_val.ops[op];
+        s.count += c.count.load(boost::memory_order_relaxed);
+        s.errors += c.errors.load(boost::memory_order_relaxed);
+        s.bytes += c.bytes.load(boost::memory_order_relaxed);
+        s.sum_ns += c.sum_ns.load(boost::memory_order_relaxed);
+        for (int i = 0; i < latency_buckets::count; ++i)
+          s.buckets[i] += c.buckets[i].load(boost::memory_order_relaxed);
+      }
+    }
+    return ret_val;
+  }
+};
+
+inline op_stats::handle::~handle()
+{
+  boost::shared_ptr<registry> r = owner.lock();
+  if (r)
+    r->retire(block);
+}
+
+// the "key\tvalue" lines of tcrdbstat, as from rdb::status()
+inline void parse_status(const std::string & status, std::map<std::string, std::string> & fields)
+{
+  std::istringstream in(status);
+  std::string line;
+  while (std::getline(in, line))
+  {
+    std::string::size_type tab = line.find('\t');
+    if (tab != std::string::npos)
+      fields[line.substr(0, tab)] = line.substr(tab + 1);
+  }
+}
+
+// prometheus text format.  system labels what's being measured, e.g. "hdb" or "rdb"
+inline void write_prometheus(std::ostream & out, const stats_snapshot & s, const std::string & system)
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  out << "# TYPE tokyooo_ops_total counter\n";
+  for (int op = 0; op < stats_op_count; ++op)
+    out << "tokyooo_ops_total{system=\"" << system << "\",op=\"" << stats_op_name(stats_op_e(op)) << "\"} "
+        << s.ops[op].count << "\n";
+  out << "# TYPE tokyooo_errors_total counter\n";
+  for (int op = 0; op < stats_op_count; ++op)
+    out << "tokyooo_errors_total{system=\"" << system << "\",op=\"" << stats_op_name(stats_op_e(op)) << "\"} "
+        << s.ops[op].errors << "\n";
+  out << "# TYPE tokyooo_bytes_total counter\n";
+  for (int op = 0; op < stats_op_count; ++op)
+    out << "tokyooo_bytes_total{system=\"" << system << "\",op=\"" << stats_op_name(stats_op_e(op)) << "\"} "
+        << s.ops[op].bytes << "\n";
+  out << "# TYPE tokyooo_latency_seconds summary\n";
+  for (int op = 0; op < stats_op_count; ++op)
+  {
+    const op_snapshot & o = s.ops[op];
+    std::string labels = "system=\"" + system + "\",op=\"" + stats_op_name(stats_op_e(op)) + "\"";
+    for (std::size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+      out << "tokyooo_latency_seconds{" << labels << ",quantile=\"" << quantiles[q] << "\"} "
+          << o.percentile(quantiles[q]) / 1e9 << "\n";
+    out << "tokyooo_latency_seconds_sum{" << labels << "} " << o.sum_ns / 1e9 << "\n";
+    out << "tokyooo_latency_seconds_count{" << labels << "} " << o.count << "\n";
+  }
+}
+
+// the numeric fields of a parsed rdb::status(), as gauges
+inline void write_prometheus(std::ostream & out, const std::map<std::string, std::string> & status,
+                             const std::string & server)
+{
+  for (std::map<std::string, std::string>::const_iterator it = status.begin(); it != status.end(); ++it)
+  {
+    char * end = NULL;
+    double value = std::strtod(it->second.c_str(), &end);
+    if (it->second.empty() || *end != '\0')
+      continue;
+    std::string name = it->first;
+    for (std::string::iterator c = name.begin(); c != name.end(); ++c)
+    {
+      if (!std::isalnum(static_cast<unsigned char>(*c)))
+        *c = '_';
+    }
+    out << "# TYPE tokyooo_server_" << name << " gauge\n"
+        << "tokyooo_server_" << name << "{server=\"" << server << "\"} " << value << "\n";
+  }
+}
+
+} // tokyooo
+
+#endif // __TOKYOOO_STATS_HPP__
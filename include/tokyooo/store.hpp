@@ -0,0 +1,88 @@
+#ifndef __TOKYOOO_STORE_HPP__
+#define __TOKYOOO_STORE_HPP__
+
+#include <string>
+
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/concept/assert.hpp>
+#include <boost/concept/usage.hpp>
+
+#include "util.hpp"
+
+namespace tokyooo {
+
+// Store: what generic code - cached_store, sharded_store, metered_store - may ask of a key/value
+// database.  hdb, bdb, rdb, adb, mdb and ndb are Stores, and so are the adapters, so they stack.  a
+// Store s has, for keys and values of any type with a codec<> (see codec.hpp):
+//
+//   s.put(key, value)  s.put(key, value, put_mode)    throws, like every call without try_
+//   s.out(key)
+//   s.get(key, value)          bool, false if key isn't there
+//   s.get_view(key, view)      bool, the bytes in a per-thread buffer
+//   s.vsize(key)               int, the size of key's value
+//   s.add(key, int)            int, the new sum
+//   s.add(key, double)         double, the new sum
+//   s.try_put, try_out, try_get, try_get_view, try_vsize, try_add
+//                              the same, handing back a result instead of throwing
+//   s.sync()  s.vanish()  s.size()
+//
+// everything is resolved at compile time, so going through the concept costs nothing over calling
+// the backend by name.  for a backend picked at run time there's adb.
+//
+//   BOOST_CONCEPT_ASSERT((Store<hdb>));
+template<class S>
+struct Store
+{
+  BOOST_CONCEPT_USAGE(Store)
+  {
+    s.put(key, value);
+    s.put(key, value, store);
+    s.out(key);
+    b = s.get(key, value);
+    b = s.get_view(key, v);
+    n = s.vsize(key);
+    n = s.add(key, n);
+    d = s.add(key, d);
+    r = s.try_put(key, value, store);
+    r = s.try_out(key);
+    r = s.try_get(key, value);
+    r = s.try_get_view(key, v);
+    r = s.try_vsize(key, n);
+    r = s.try_add(key, n, n);
+    r = s.try_add(key, d, d);
+    s.sync();
+    s.vanish();
+    size = s.size();
+  }
+
+private:
+
+  S s;
+  std::string key;
+  std::string value;
+  view v;
+  result r;
+  bool b;
+  int n;
+  double d;
+  size_type size;
+};
+
+// what a Store can do beyond the concept.  each backend specializes these next to its own
+// definition; generic code checks them with BOOST_STATIC_ASSERT, or picks an overload on them
+
+// keys come back in order, and there are ranges over them (bdb, ndb)
+template<class S>
+struct supports_ordered_scan : boost::false_type {};
+
+// rows of columns, with tbl_put, tbl_get, tbl_out and query (rdb, tdb)
+template<class S>
+struct supports_tables : boost::false_type {};
+
+// S::transaction, committed or rolled back as a whole (hdb, bdb, tdb, adb)
+template<class S>
+struct supports_transactions : boost::false_type {};
+
+} // tokyooo
+
+#endif // __TOKYOOO_STORE_HPP__
@@ -0,0 +1,337 @@
+#ifndef __TOKYOOO_TDB_HPP__
+#define __TOKYOOO_TDB_HPP__
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+
+#include <tcutil.h>
+#include <tctdb.h>
+#include "util.hpp"
+#include "map.hpp"
+#include "stats.hpp"
+#include "store.hpp"
+
+namespace tokyooo {
+
+// the options, outside the template so every basic_tdb shares them
+struct tdb_base
+{
+  enum tune_options_e
+  {
+    tune_default = 0,
+    large = TDBTLARGE,
+    deflate = TDBTDEFLATE,
+    bzip = TDBTBZIP,
+    tcbs = TDBTTCBS
+  };
+  enum open_options_e
+  {
+    open_default = 0,
+    writer = TDBOWRITER,
+    reader = TDBOREADER,
+    create = TDBOCREAT,
+    trunc = TDBOTRUNC,
+    synchronize = TDBOTSYNC,
+    no_lock = TDBONOLCK,
+    lock_nb = TDBOLCKNB
+  };
+  enum index_options_e
+  {
+    lexical = TDBITLEXICAL,
+    decimal = TDBITDECIMAL,
+    token = TDBITTOKEN,
+    qgram = TDBITQGRAM,
+    optimized = TDBITOPT,
+    remove = TDBITVOID,
+    keep = TDBITKEEP
+  };
+};
+
+// the table database in this process: rdb's table api - tbl_put, tbl_get, set_index - on a .tct
+// file of our own, with no server and no round trip.  run queries on it with tdb_query (see
+// query.hpp).  a cursor fetches on a thread of its own, so open with mutexed if you use one
+template<class Stats = no_stats>
+class basic_tdb : public tdb_base, public boost::noncopyable
+{
+private:
+
+  TCTDB * tdb_;
+
+  Stats stats_;
+
+  result outcome(bool ok, typename Stats::timer & t)
+  {
+    if (ok)
+      return result();
+    result ret_val(tdb_);
+    if (ret_val.failed())
+      t.add_error();
+    return ret_val;
+  }
+
+  void init(bool mutexed, boost::int64_t bnum, char apow, char fpow, tune_options_e opts,
+            int rcnum, int lcnum, int ncnum, boost::int64_t xmsize)
+  {
+    if (mutexed)
+      set_mutexed();
+    tune(bnum, apow, fpow, opts);
+    set_cache(rcnum, lcnum, ncnum);
+    set_extra_mm(xmsize);
+  }
+
+public:
+
+  basic_tdb( bool mutexed = false,
+             boost::int64_t bnum = 131071,
+             char apow = 4,
+             char fpow = 10,
+             tune_options_e opts = tune_default,
+             int rcnum = 0,
+             int lcnum = 0,
+             int ncnum = 0,
+             boost::int64_t xmsize = 67108864 )
+  : tdb_(tctdbnew())
+  {
+    init(mutexed, bnum, apow, fpow, opts, rcnum, lcnum, ncnum, xmsize);
+  }
+
+  basic_tdb( const std::string & path,
+             open_options_e options = open_default,
+             bool mutexed = false,
+             boost::int64_t bnum = 131071,
+             char apow = 4,
+             char fpow = 10,
+             tune_options_e opts = tune_default,
+             int rcnum = 0,
+             int lcnum = 0,
+             int ncnum = 0,
+             boost::int64_t xmsize = 67108864 )
+  : tdb_(tctdbnew())
+  {
+    init(mutexed, bnum, apow, fpow, opts, rcnum, lcnum, ncnum, xmsize);
+    open(path, options);
+  }
+
+  ~basic_tdb()
+  {
+    tctdbclose(tdb_);
+    tctdbdel(tdb_);
+  }
+
+  void set_mutexed()
+  {
+    tctdbsetmutex(tdb_) || err::go(tdb_);
+  }
+
+  void tune( boost::int64_t bnum, char apow, char fpow, tune_options_e opts )
+  {
+    tctdbtune(tdb_, bnum, apow, fpow, opts) || err::go(tdb_);
+  }
+
+  // rcnum caches rows, lcnum and ncnum the leaf and inner pages of the indexes.  0 is tctdb's default
+  void set_cache(int rcnum, int lcnum, int ncnum)
+  {
+    tctdbsetcache(tdb_, rcnum, lcnum, ncnum) || err::go(tdb_);
+  }
+
+  void set_extra_mm(boost::int64_t xmsize)
+  {
+    tctdbsetxmsiz(tdb_, xmsize) || err::go(tdb_);
+  }
+
+  void open(const std::string & path, open_options_e options = open_default)
+  {
+    typename Stats::timer t(stats_, op_open);
+    tctdbopen(tdb_, path.c_str(), options) || err::go(tdb_);
+  }
+
+  void close()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tctdbclose(tdb_) || err::go(tdb_);
+  }
+
+  // table api, as on rdb:
+  template<class Key>
+  void tbl_put( const Key & key, map & row, put_mode_e mode = store )
+  {
+    result r = try_tbl_put(key, row, mode);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  void tbl_out(const Key & key)
+  {
+    result r = try_tbl_out(key);
+    r.ok() || err::go(r);
+  }
+
+  template<class Key>
+  bool tbl_get(const Key & key, map & m)
+  {
+    result r = try_tbl_get(key, m);
+    if (r.not_found())
+      return false;
+    r.ok() || err::go(r);
+    return true;
+  }
+
+  template<class Key>
+  result try_tbl_put( const Key & key, map & row, put_mode_e mode = store )
+  {
+    typename Stats::timer t(stats_, op_put);
+    packed k(key);
+    t.add_bytes(k.size());
+    bool ok = false;
+    switch (mode)
+    {
+    case store: ok = tctdbput(tdb_, k.data(), k.size(), row.native() ); break;
+    case tokyooo::keep: ok = tctdbputkeep(tdb_, k.data(), k.size(), row.native() ); break;
+    case cat: ok = tctdbputcat(tdb_, k.data(), k.size(), row.native() ); break;
+    default: err::go("expardon me?"); break;
+    }
+    return outcome(ok, t);
+  }
+
+  template<class Key>
+  result try_tbl_out(const Key & key)
+  {
+    typename Stats::timer t(stats_, op_out);
+    packed k(key);
+    t.add_bytes(k.size());
+    return outcome(tctdbout(tdb_, k.data(), k.size()), t);
+  }
+
+  template<class Key>
+  result try_tbl_get(const Key & key, map & m)
+  {
+    typename Stats::timer t(stats_, op_get);
+    packed k(key);
+    t.add_bytes(k.size());
+    map tmp( tctdbget( tdb_, k.data(), k.size() ) );
+    if (!tmp.native())
+      return outcome(false, t);
+    m.swap(tmp);
+    return result();
+  }
+
+  void set_index( const std::string & name, index_options_e options )
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tctdbsetindex(tdb_, name.c_str(), options) || err::go(tdb_);
+  }
+
+  uid genuid()
+  {
+    uid ret_val = tctdbgenuid(tdb_);
+    (ret_val >= 0) || err::go(tdb_);
+    return ret_val;
+  }
+
+  // one transaction at a time, so others wait here for this one to finish
+  class transaction : public boost::noncopyable
+  {
+  private:
+
+    basic_tdb & tdb_;
+
+    bool open_;
+
+  public:
+
+    explicit transaction(basic_tdb & t)
+    : tdb_(t), open_(false)
+    {
+      tctdbtranbegin(tdb_.native()) || err::go(tdb_.native());
+      open_ = true;
+    }
+
+    ~transaction()
+    {
+      if (open_)
+        tctdbtranabort(tdb_.native());
+    }
+
+    void commit()
+    {
+      typename Stats::timer t(tdb_.stats(), op_misc);
+      open_ = false;
+      tctdbtrancommit(tdb_.native()) || err::go(tdb_.native());
+    }
+
+    void abort()
+    {
+      open_ = false;
+      tctdbtranabort(tdb_.native()) || err::go(tdb_.native());
+    }
+  };
+
+  void sync()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tctdbsync(tdb_) || err::go(tdb_);
+  }
+
+  void optimize( boost::int64_t bnum, char apow, char fpow, tune_options_e opts )
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tctdboptimize(tdb_, bnum, apow, fpow, opts) || err::go(tdb_);
+  }
+
+  void vanish()
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tctdbvanish(tdb_) || err::go(tdb_);
+  }
+
+  void copy(const std::string & path)
+  {
+    typename Stats::timer t(stats_, op_admin);
+    tctdbcopy(tdb_, path.c_str()) || err::go(tdb_);
+  }
+
+  std::string path()
+  {
+    return std::string( tctdbpath(tdb_) );
+  }
+
+  size_type size()
+  {
+    return tctdbrnum(tdb_);
+  }
+
+  size_type fsize()
+  {
+    return tctdbfsiz(tdb_);
+  }
+
+  TCTDB * native()
+  {
+    return tdb_;
+  }
+
+  Stats & stats()
+  {
+    return stats_;
+  }
+
+  void set_stats(const Stats & stats)
+  {
+    stats_ = stats;
+  }
+};
+
+// rows only, so not a Store, but the traits still say what it can do
+template<class Stats>
+struct supports_tables< basic_tdb<Stats> > : boost::true_type {};
+
+template<class Stats>
+struct supports_transactions< basic_tdb<Stats> > : boost::true_type {};
+
+typedef basic_tdb<> tdb;
+
+} // tokyooo
+
+#endif // __TOKYOOO_TDB_HPP__
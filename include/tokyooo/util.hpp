@@ -2,13 +2,19 @@
 #define __TOKYOPP_UTIL_HPP__
 
 #include <vector>
+#include <iterator>
 
 #include <tcrdb.h>
 #include <tchdb.h>
+#include <tcbdb.h>
+#include <tcfdb.h>
+#include <tctdb.h>
 #include <string>
 #include <cstring>
 #include <stdexcept>
 #include <boost/cstdint.hpp>
+#include <boost/thread/tss.hpp>
+#include "codec.hpp"
 
 namespace tokyooo {
 
@@ -20,6 +26,63 @@ enum put_mode_e
   shl,    // concatenate a value at the end of the existing record and shift it to the left
   nr,     // store a record without response from the server
   async,  // store in an asynchronous fashion
+  duplicate, // store another record under the same key (bdb only)
+};
+
+// what the try_ calls hand back instead of throwing: just the error code tokyo cabinet or tyrant
+// left behind, so a miss costs neither an allocation nor an unwind.  not_found() and exists() are
+// the everyday outcomes (no such record, keep on a record that's there); failed() is the rest
+class result
+{
+public:
+
+  enum source_e
+  {
+    cabinet,
+    tyrant
+  };
+
+private:
+
+  int code_;
+
+  source_e source_;
+
+public:
+
+  result() : code_(0), source_(cabinet) {}
+
+  explicit result(TCHDB * hdb) : code_(tchdbecode(hdb)), source_(cabinet) {}
+
+  explicit result(TCBDB * bdb) : code_(tcbdbecode(bdb)), source_(cabinet) {}
+
+  explicit result(TCFDB * fdb) : code_(tcfdbecode(fdb)), source_(cabinet) {}
+
+  explicit result(TCTDB * tdb) : code_(tctdbecode(tdb)), source_(cabinet) {}
+
+  explicit result(TCRDB * rdb) : code_(tcrdbecode(rdb)), source_(tyrant) {}
+
+  // for a database that keeps no error code of its own (adb), so the caller says what went wrong
+  explicit result(int code, source_e source = cabinet) : code_(code), source_(source) {}
+
+  // TCESUCCESS and TTESUCCESS are both 0
+  bool ok() const { return code_ == 0; }
+
+  bool not_found() const { return code_ == (source_ == cabinet ? int(TCENOREC) : int(TTENOREC)); }
+
+  bool exists() const { return code_ == (source_ == cabinet ? int(TCEKEEP) : int(TTEKEEP)); }
+
+  bool failed() const { return !ok() && !not_found() && !exists(); }
+
+  int code() const { return code_; }
+
+  source_e source() const { return source_; }
+
+  // a static string, nothing to free
+  const char * message() const
+  {
+    return source_ == cabinet ? tchdberrmsg(code_) : tcrdberrmsg(code_);
+  }
 };
 
 struct err
@@ -36,6 +99,30 @@ struct err
     return true;
   }
 
+  static bool go(TCBDB * bdb)
+  {
+    throw std::runtime_error( tcbdberrmsg( tcbdbecode ( bdb ) ) );
+    return true;
+  }
+
+  static bool go(TCFDB * fdb)
+  {
+    throw std::runtime_error( tcfdberrmsg( tcfdbecode ( fdb ) ) );
+    return true;
+  }
+
+  static bool go(TCTDB * tdb)
+  {
+    throw std::runtime_error( tctdberrmsg( tctdbecode ( tdb ) ) );
+    return true;
+  }
+
+  static bool go(const result & r)
+  {
+    throw std::runtime_error( r.message() );
+    return true;
+  }
+
   static bool go(const std::string & e)
   {
     throw std::runtime_error( e.c_str() );
@@ -43,27 +130,141 @@ struct err
   }
 };
 
-// TODO: a more formal approach here, with probably default support for stream operator, and optional boost::archive
-struct ser
+// a pointer and a length into bytes that belong to somebody else (a database's iteration buffers,
+// a map's own storage).  it's only good for as long as the owner leaves those bytes alone
+struct view
 {
-  static const void * cptr(const std::string & value) { return value.c_str(); }
-  static const void * cptr(const char * value) { return value; }
-  template<class T> static const void * cptr( const std::vector<T> & value ) { return &value[0]; }
-  template<class T> static const void * cptr(const T & value) { return &value; }
-  static int len(const std::string & value) { return value.size(); }
-  static int len(const char * value) { return strlen(value); }
-  template<class T> static int len(const std::vector<T> & value) { return value.size() * sizeof(T); }
-  template<class T> static int len(const T & value) { return sizeof(T); }
-  static void assign(std::string & value, const void * p, int len) { value = reinterpret_cast<const char *>(p); }
-  template<class T> static void assign(std::vector<T> & value, const void * p, int len)
-  { value.assign(reinterpret_cast<const T*>(p), reinterpret_cast<const T*>(reinterpret_cast<const char *>(p) + len)); }
-  template<class T> static void assign(T & value, const void * p, int len) { value = *reinterpret_cast<const T*>(p); }
+  const char * data;
+  int size;
+
+  view() : data(NULL), size(0) {}
+
+  view(const void * d, int s) : data(reinterpret_cast<const char *>(d)), size(s) {}
+
+  bool empty() const { return size == 0; }
+
+  std::string str() const { return std::string(data, size); }
+};
+
+inline bool operator== (const view & a, const view & b)
+{
+  return a.size == b.size && std::memcmp(a.data, b.data, a.size) == 0;
+}
+
+inline bool operator!= (const view & a, const view & b)
+{
+  return !(a == b);
+}
+
+template<> struct is_bitwise<view> : boost::false_type {};
+
+// views go into the database as the bytes they point at.  there's no decoding into one - the
+// bytes would be gone by the time you looked - use get_view() or the iterators instead
+template<>
+struct codec<view> : codec_base< view, codec<view> >
+{
+  static const bool direct = true;
+
+  static const void * data(const view & v) { return v.data; }
+
+  static int size(const view & v) { return v.size; }
+
+  static char * encode(const view & v, char * out)
+  {
+    std::memcpy(out, v.data, v.size);
+    return out + v.size;
+  }
+};
+
+struct record
+{
+  view key;
+  view value;
 };
 
+template<> struct is_bitwise<record> : boost::false_type {};
+
+// scratch space that get_view() copies values into.  one per thread, and it only ever grows, so
+// once it's big enough for your values reads stop allocating
+inline std::vector<char> & thread_buffer()
+{
+  static boost::thread_specific_ptr< std::vector<char> > buffer;
+  if (!buffer.get())
+    buffer.reset(new std::vector<char>(1024));
+  return *buffer;
+}
+
+// decode a value tokyo cabinet handed back, or throw if those bytes can't be a T
+template<class T>
+inline void unpack(T & value, const void * p, int size)
+{
+  codec<T>::decode(value, reinterpret_cast<const char *>(p), size) || err::go("tokyooo: can't decode value of that size");
+}
+
+// murmurhash64a, for spreading keys over shards.  the bytes hashed are the key's encoding, so the
+// same key lands in the same place whatever process computes it
+inline boost::uint64_t hash(const void * data, int size, boost::uint64_t seed = 0)
+{
+  const boost::uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const unsigned char * p = reinterpret_cast<const unsigned char *>(data);
+  const unsigned char * end = p + (size & ~7);
+  boost::uint64_t h = seed ^ (size * m);
+  for (; p != end; p += 8)
+  {
+    boost::uint64_t k;
+    std::memcpy(&k, p, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  // the last size % 8 bytes, as murmur's fall-through switch takes them
+  if (size & 7)
+  {
+    for (int i = (size & 7) - 1; i >= 0; --i)
+      h ^= boost::uint64_t(p[i]) << (8 * i);
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+template<class Key>
+inline boost::uint64_t hash_key(const Key & key)
+{
+  packed k(key);
+  return hash(k.data(), k.size());
+}
+
 typedef boost::uint64_t size_type;
 
 typedef boost::int64_t uid;
 
+namespace detail {
+
+template<class Iterator>
+int distance(Iterator, Iterator, std::input_iterator_tag) { return 0; }
+
+template<class Iterator>
+int distance(Iterator begin, Iterator end, std::forward_iterator_tag)
+{
+  return std::distance(begin, end);
+}
+
+// how many items are in begin..end, for sizing a list or map up front - 0 if the iterators can't
+// tell without using them up
+template<class Iterator>
+int distance(Iterator begin, Iterator end)
+{
+  return distance(begin, end, typename std::iterator_traits<Iterator>::iterator_category());
+}
+
+} // detail
+
 } // tokyooo
 
 #endif // __TOKYOPP_UTIL_HPP__
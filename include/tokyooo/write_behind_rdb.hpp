@@ -0,0 +1,477 @@
+#ifndef __TOKYOOO_WRITE_BEHIND_RDB_HPP__
+#define __TOKYOOO_WRITE_BEHIND_RDB_HPP__
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <exception>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <tcrdb.h>
+#include "util.hpp"
+#include "rdb.hpp"
+
+namespace tokyooo {
+
+// buffers writes to an rdb and sends them in bulk from a background thread, keeping only what
+// each key would end up as: a put replaces whatever was pending for its key, cats append to it,
+// and adds are summed (or applied to a pending put of the right size).  puts go out with
+// "putlist" and outs with "outlist", so a flush costs a round trip per batch_bytes rather than per
+// write.  a flush happens every interval, as soon as max_pending keys or max_bytes of values are
+// waiting, or when you call flush().
+//
+// writes other clients make in the meantime can land in any order relative to the buffered ones,
+// and until a flush the server doesn't have them at all - close() (or the destructor, which can't
+// report errors) flushes what's left.  if a flush fails the puts and outs in it are put back to be
+// tried again, but cats and adds may have partly happened, so those are dropped and counted as lost.
+class write_behind_rdb : public boost::noncopyable
+{
+public:
+
+  struct stats
+  {
+    boost::uint64_t writes;           // put/out/cat/add calls
+    boost::uint64_t coalesced;        // ...that merged into one already waiting
+    boost::uint64_t flushes;
+    boost::uint64_t flushed;          // keys sent
+    boost::uint64_t failed_flushes;
+    boost::uint64_t lost;             // writes dropped by a failed flush
+    boost::uint64_t flush_usec;       // total time spent flushing
+    boost::uint64_t max_flush_usec;
+    boost::uint64_t last_flush_usec;
+    std::size_t pending;              // keys waiting right now
+    std::size_t pending_bytes;        // ...and the size of their values
+    std::size_t max_pending;          // most keys ever waiting at once
+  };
+
+private:
+
+  enum kind_e
+  {
+    put_op,
+    out_op,
+    cat_op,
+    add_int_op,
+    add_double_op
+  };
+
+  struct pending
+  {
+    kind_e kind;
+    std::string value;  // for put and cat
+    int i;              // for add_int
+    double d;           // for add_double
+  };
+
+  typedef boost::unordered_map<std::string, pending> pending_t;
+
+  rdb & rdb_;
+
+  std::size_t max_pending_;
+
+  std::size_t max_bytes_;
+
+  boost::posix_time::time_duration interval_;
+
+  rdb::misc_options_e options_;
+
+  boost::mutex mutex_;          // pending_, flushing_, bytes_, stats_, stop_
+
+  boost::mutex flush_mutex_;    // one flush at a time, so they reach the server in order
+
+  boost::condition_variable wake_;
+
+  pending_t pending_;
+
+  pending_t * flushing_;        // the batch being sent, if there is one
+
+  std::size_t bytes_;
+
+  stats stats_;
+
+  bool stop_;
+
+  boost::scoped_ptr<boost::thread> thread_;
+
+  bool full() const
+  {
+    return pending_.size() >= max_pending_ || bytes_ >= max_bytes_;
+  }
+
+  // folds newer into older, the way the server would apply them one after the other.  false if it
+  // can't - a cat after an add, say
+  static bool merge(pending & older, const pending & newer)
+  {
+    if (newer.kind == put_op || newer.kind == out_op)
+    {
+      older = newer;
+      return true;
+    }
+    if (older.kind == out_op)
+    {
+      // applied to a missing record, each of these just stores its operand
+      older.kind = put_op;
+      if (newer.kind == cat_op)
+        older.value = newer.value;
+      else if (newer.kind == add_int_op)
+        older.value.assign(reinterpret_cast<const char *>(&newer.i), sizeof(newer.i));
+      else
+        older.value.assign(reinterpret_cast<const char *>(&newer.d), sizeof(newer.d));
+      return true;
+    }
+    switch (newer.kind)
+    {
+    case cat_op:
+      if (older.kind != put_op && older.kind != cat_op)
+        return false;
+      older.value += newer.value;
+      return true;
+    case add_int_op:
+      if (older.kind == add_int_op)
+        older.i += newer.i;
+      else if (older.kind == put_op && older.value.size() == sizeof(int))
+      {
+        int n = 0;
+        std::memcpy(&n, older.value.data(), sizeof(n));
+        n += newer.i;
+        std::memcpy(&older.value[0], &n, sizeof(n));
+      }
+      else
+        return false;
+      return true;
+    case add_double_op:
+      if (older.kind == add_double_op)
+        older.d += newer.d;
+      else if (older.kind == put_op && older.value.size() == sizeof(double))
+      {
+        double n = 0;
+        std::memcpy(&n, older.value.data(), sizeof(n));
+        n += newer.d;
+        std::memcpy(&older.value[0], &n, sizeof(n));
+      }
+      else
+        return false;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // sends one key's op on its own
+  void apply(const std::string & key, const pending & p)
+  {
+    TCRDB * r = rdb_.native();
+    switch (p.kind)
+    {
+    case put_op: tcrdbput(r, key.data(), key.size(), p.value.data(), p.value.size()) || err::go(r); break;
+    case out_op: (tcrdbout(r, key.data(), key.size()) || tcrdbecode(r) == TTENOREC) || err::go(r); break;
+    case cat_op: tcrdbputcat(r, key.data(), key.size(), p.value.data(), p.value.size()) || err::go(r); break;
+    case add_int_op:
+      (tcrdbaddint(r, key.data(), key.size(), p.i) != std::numeric_limits<int>::min()) || err::go(r);
+      break;
+    case add_double_op:
+      !std::isnan(tcrdbadddouble(r, key.data(), key.size(), p.d)) || err::go(r);
+      break;
+    }
+  }
+
+  // what's waiting for key: in pending_, or failing that in the batch being sent.  null if neither.
+  // call with mutex_ held
+  const pending * find_pending(const std::string & key)
+  {
+    pending_t::const_iterator it = pending_.find(key);
+    if (it != pending_.end())
+      return &it->second;
+    if (flushing_ != NULL)
+    {
+      it = flushing_->find(key);
+      if (it != flushing_->end())
+        return &it->second;
+    }
+    return NULL;
+  }
+
+  // false if p can't be merged with what's already waiting for its key
+  bool try_enqueue(const std::string & key, const pending & p)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    pending_t::iterator it = pending_.find(key);
+    if (it == pending_.end())
+    {
+      pending_.insert(std::make_pair(key, p));
+      bytes_ += key.size() + p.value.size();
+    }
+    else
+    {
+      std::size_t before = it->second.value.size();
+      if (!merge(it->second, p))
+        return false;
+      bytes_ += it->second.value.size();
+      bytes_ -= before;
+      ++stats_.coalesced;
+    }
+    ++stats_.writes;
+    stats_.max_pending = std::max(stats_.max_pending, pending_.size());
+    if (full())
+      wake_.notify_one();
+    return true;
+  }
+
+  // when p can't be merged, everything waiting is flushed first so the two reach the server in
+  // order.  rare enough not to matter
+  void enqueue(const packed & k, const pending & p)
+  {
+    std::string key(static_cast<const char *>(k.data()), k.size());
+    if (try_enqueue(key, p))
+      return;
+    flush();
+    if (!try_enqueue(key, p))
+      err::go("tokyooo: write_behind_rdb couldn't make room for a write");
+  }
+
+  // puts a failed batch back under anything newer, keeping only what's safe to send twice
+  void restore(pending_t & batch)
+  {
+    for (pending_t::iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+      if (it->second.kind != put_op && it->second.kind != out_op)
+      {
+        ++stats_.lost;
+        continue;
+      }
+      pending_t::iterator newer = pending_.find(it->first);
+      if (newer == pending_.end())
+      {
+        pending_.insert(*it);
+        bytes_ += it->first.size() + it->second.value.size();
+      }
+      else
+      {
+        bytes_ -= newer->second.value.size();
+        pending old = it->second;
+        if (merge(old, newer->second))
+          newer->second = old;
+        else
+          ++stats_.lost;
+        bytes_ += newer->second.value.size();
+      }
+    }
+  }
+
+  // sends everything waiting.  returns the error, if there was one
+  std::string flush_once()
+  {
+    boost::mutex::scoped_lock flushing(flush_mutex_);
+    pending_t batch;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      batch.swap(pending_);
+      bytes_ = 0;
+      if (batch.empty())
+        return std::string();
+      flushing_ = &batch;
+    }
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    std::string error;
+    try
+    {
+      std::vector< std::pair<view, view> > puts;
+      std::vector<view> outs;
+      for (pending_t::iterator it = batch.begin(); it != batch.end(); ++it)
+      {
+        view k(it->first.data(), it->first.size());
+        if (it->second.kind == put_op)
+          puts.push_back(std::make_pair(k, view(it->second.value.data(), it->second.value.size())));
+        else if (it->second.kind == out_op)
+          outs.push_back(k);
+      }
+      rdb_.put_many(puts.begin(), puts.end(), options_);
+      rdb_.out_many(outs.begin(), outs.end(), options_);
+      for (pending_t::iterator it = batch.begin(); it != batch.end(); ++it)
+      {
+        if (it->second.kind != put_op && it->second.kind != out_op)
+          apply(it->first, it->second);
+      }
+    }
+    catch (std::exception & e)
+    {
+      error = e.what();
+    }
+    boost::uint64_t usec = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+    boost::mutex::scoped_lock lock(mutex_);
+    flushing_ = NULL;
+    ++stats_.flushes;
+    stats_.flush_usec += usec;
+    stats_.last_flush_usec = usec;
+    stats_.max_flush_usec = std::max(stats_.max_flush_usec, usec);
+    if (error.empty())
+      stats_.flushed += batch.size();
+    else
+    {
+      ++stats_.failed_flushes;
+      restore(batch);
+    }
+    return error;
+  }
+
+  void run()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!stop_)
+    {
+      if (!full())
+        wake_.timed_wait(lock, interval_);
+      if (stop_)
+        break;
+      lock.unlock();
+      flush_once(); // failures are counted, and retried next time round
+      lock.lock();
+    }
+  }
+
+  void stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    if (thread_)
+    {
+      thread_->join();
+      thread_.reset();
+    }
+  }
+
+public:
+
+  write_behind_rdb( rdb & r,
+                    std::size_t max_pending = 10000,
+                    std::size_t max_bytes = 4 << 20,
+                    const boost::posix_time::time_duration & interval = boost::posix_time::milliseconds(100),
+                    rdb::misc_options_e options = rdb::misc_default )
+  : rdb_(r), max_pending_(max_pending ? max_pending : 1), max_bytes_(max_bytes ? max_bytes : 1),
+    interval_(interval), options_(options), flushing_(NULL), bytes_(0), stop_(false)
+  {
+    stats s = {};
+    stats_ = s;
+    thread_.reset( new boost::thread(&write_behind_rdb::run, this) );
+  }
+
+  // flushes what's left - call close() first if you want to know whether that worked
+  ~write_behind_rdb()
+  {
+    try
+    {
+      close();
+    }
+    catch (...)
+    {
+    }
+  }
+
+  template<class Key, class Value>
+  void put(const Key & key, const Value & value, put_mode_e put_mode = store)
+  {
+    packed k(key), v(value);
+    pending p = { put_op, std::string(static_cast<const char *>(v.data()), v.size()), 0, 0 };
+    switch (put_mode)
+    {
+    case store: break;
+    case cat: p.kind = cat_op; break;
+    default: err::go("tokyooo: write_behind_rdb only buffers store and cat puts"); break;
+    }
+    enqueue(k, p);
+  }
+
+  template<class Key>
+  void out(const Key & key)
+  {
+    packed k(key);
+    pending p = { out_op, std::string(), 0, 0 };
+    enqueue(k, p);
+  }
+
+  // unlike rdb::add there's no new value to give back - it isn't known until the flush
+  template<class Key>
+  void add(const Key & key, int value)
+  {
+    packed k(key);
+    pending p = { add_int_op, std::string(), value, 0 };
+    enqueue(k, p);
+  }
+
+  template<class Key>
+  void add(const Key & key, double value)
+  {
+    packed k(key);
+    pending p = { add_double_op, std::string(), 0, value };
+    enqueue(k, p);
+  }
+
+  // sees this object's own buffered writes, the ones being flushed included: a pending put or out
+  // is answered without asking the server, and a pending cat or add gets flushed first
+  template<class Key, class Value>
+  bool get(const Key & key, Value & value)
+  {
+    packed k(key);
+    std::string ks(static_cast<const char *>(k.data()), k.size());
+    bool flush_first = false;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      const pending * p = find_pending(ks);
+      if (p != NULL && p->kind == out_op)
+        return false;
+      if (p != NULL && p->kind == put_op)
+      {
+        unpack(value, p->value.data(), p->value.size());
+        return true;
+      }
+      flush_first = p != NULL;
+    }
+    if (flush_first)
+      flush();
+    return rdb_.get(view(ks.data(), ks.size()), value);
+  }
+
+  // sends everything written so far, and throws if that fails
+  void flush()
+  {
+    std::string error = flush_once();
+    if (!error.empty())
+      err::go(error);
+  }
+
+  // stops the background thread and flushes what's left.  anything written after this waits for
+  // an explicit flush()
+  void close()
+  {
+    stop();
+    flush();
+  }
+
+  stats statistics()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stats ret_val = stats_;
+    ret_val.pending = pending_.size();
+    ret_val.pending_bytes = bytes_;
+    return ret_val;
+  }
+};
+
+} // tokyooo
+
+#endif // __TOKYOOO_WRITE_BEHIND_RDB_HPP__
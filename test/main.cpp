@@ -2,6 +2,7 @@
 #include <tokyooo/map.hpp>
 #include <tokyooo/rdb.hpp>
 #include <tokyooo/hdb.hpp>
+#include <tokyooo/auto_tuned_hdb.hpp>
 #include <tokyooo/list.hpp>
 #include <tokyooo/query.hpp>
 
@@ -9,6 +10,21 @@ using namespace tokyooo;
 
 int main(int argc, char * argv[])
 {
+  // sharded_hdb and sharded_rdb place keys by hash(), so it must never change: MurmurHash64A of
+  // the first n bytes of "abcdefghi" - empty, every tail length, a whole word and a word plus one
+  {
+    static const boost::uint64_t known[] = {
+      0x0000000000000000ULL, 0x071717d2d36b6b11ULL, 0x62be85b2fe53d1f8ULL, 0x9cc9c33498a95efbULL,
+      0xec1044c45cc5097aULL, 0x1182974836d6dbb7ULL, 0xb78e3425fc996779ULL, 0x241aa52b0a62005dULL,
+      0xafdb0257ff41aa98ULL, 0xc9b9d84356146ac2ULL };
+    bool ok = hash("abcdefghi", 9, 42) == 0x8e8839d3e52c9415ULL;
+    for (int n = 0; n < 10; ++n)
+      ok = ok && hash("abcdefghi", n) == known[n];
+    std::cout << "hash " << (ok ? "ok" : "CHANGED") << std::endl;
+    if (!ok)
+      return 1;
+  }
+
   rdb r("localhost", 1978);
 
   map row;
@@ -31,4 +47,20 @@ int main(int argc, char * argv[])
 
   hdb h("hdb_test");
 
+  // rebuilt twice running: the second copies from the file the first renamed into place
+  {
+    auto_tuned_hdb a("auto_tuned_test.tch", 1000, 16,
+                     hdb::open_options_e(hdb::writer | hdb::create | hdb::trunc), 0);
+    for (int i = 0; i < 10000; ++i)
+      a.put(i, i);
+    a.rebuild();
+    a.rebuild();
+    int y = 0;
+    std::cout << a.path() << " " << a.size() << " " << a.bucket_count() << " "
+              << (a.get(9999, y) && y == 9999 ? "ok" : "lost") << std::endl;
+    std::vector<auto_tuned_hdb::rebuild_report> reports = a.rebuilds();
+    for (std::size_t i = 0; i < reports.size(); ++i)
+      std::cout << "rebuild " << reports[i].usec << "us, " << reports[i].old_bnum << " -> "
+                << reports[i].new_bnum << " " << reports[i].error << std::endl;
+  }
 }